@@ -0,0 +1,253 @@
+#!/bin/sh
+#
+# Regression benchmark suite: time fib, nqueens and sample_qsort at fixed
+# sizes and worker counts, store the trial times as JSON, and compare them
+# against a saved baseline.
+#
+#   ./bench.sh [-b <bindir>] [-w "<workers>"] [-r <trials>] [-o <out.json>]
+#              [-c <baseline.json>] [-i <results.json>] [-a <alpha>]
+#              [-t <threshold>]
+#
+#   -b <bindir>         directory with the fib, nqueens and qsort binaries
+#                       (default: .)
+#   -w "<counts>"       worker counts to run (default: 1 and the number of
+#                       online cores)
+#   -r <trials>         timed trials per benchmark, after one untimed warm-up
+#                       (default: 10)
+#   -o <out.json>       write the results here (default: stdout)
+#   -c <baseline.json>  compare the results against this baseline
+#   -i <results.json>   compare these saved results instead of running
+#   -a <alpha>          significance level of the comparison (default: 0.01)
+#   -t <threshold>      smallest median slowdown to report, as a fraction
+#                       (default: 0.05)
+#
+# The sizes come from BENCH_FIB, BENCH_NQUEENS and BENCH_QSORT.  qsort runs
+# its trials in one process with its own warm-up (-w 1); fib and nqueens run
+# once per trial.
+#
+# A benchmark regresses if a one-sided Mann-Whitney U test finds its times
+# larger than the baseline's at level <alpha> and its median is more than
+# <threshold> slower.  The comparison is printed to stderr, and the exit
+# status is 1 if any benchmark regressed.  The test needs enough trials on
+# both sides to reach <alpha>: at least 5 each for the default 0.01.
+
+bindir=.
+workers=
+trials=10
+out=
+baseline=
+results=
+alpha=0.01
+threshold=0.05
+
+while getopts "b:w:r:o:c:i:a:t:h" opt; do
+  case $opt in
+    b) bindir=$OPTARG ;;
+    w) workers=$OPTARG ;;
+    r) trials=$OPTARG ;;
+    o) out=$OPTARG ;;
+    c) baseline=$OPTARG ;;
+    i) results=$OPTARG ;;
+    a) alpha=$OPTARG ;;
+    t) threshold=$OPTARG ;;
+    h) sed -n '2,34s/^# \{0,1\}//p' "$0"; exit 0 ;;
+    *) exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+: "${BENCH_FIB:=35}"
+: "${BENCH_NQUEENS:=12}"
+: "${BENCH_QSORT:=10000000}"
+
+if [ -z "$workers" ]; then
+  ncores=$(getconf _NPROCESSORS_ONLN)
+  workers=1
+  [ "$ncores" -gt 1 ] && workers="1 $ncores"
+fi
+
+# Print the times of the Time(<label>) lines of one run's output.
+trial_times() {
+  awk -v label="$1" 'index($0, "Time(" label ") = ") == 1 { print $3 + 0 }'
+}
+
+# Run one benchmark and print its JSON result line.
+run() {
+  prog=$1 n=$2 p=$3
+  case $prog in
+    qsort)
+      # the harness reports failed sorts instead of "All sorts succeeded"
+      log=$(CILK_NWORKERS=$p "$bindir/qsort" -w 1 "$n" "$trials") || return 1
+      t=$(echo "$log" | trial_times sample_qsort) ;;
+    *)
+      # nqueens reports its progress on stderr
+      CILK_NWORKERS=$p "$bindir/$prog" "$n" > /dev/null 2>&1 || return 1
+      t=
+      i=0
+      while [ "$i" -lt "$trials" ]; do
+        t="$t $(CILK_NWORKERS=$p "$bindir/$prog" "$n" 2> /dev/null \
+                | trial_times "$prog")"
+        i=$((i + 1))
+      done ;;
+  esac
+  set -- $t
+  if [ $# -ne "$trials" ]; then
+    echo "$prog $n failed on $p workers" >&2
+    return 1
+  fi
+  echo $t | awk -v prog="$prog" -v n="$n" -v p="$p" '{
+    fmt = "  {\"program\": \"%s\", \"n\": %s, \"workers\": %s, "
+    printf fmt "\"times_sec\": [", prog, n, p
+    for (i = 1; i <= NF; i++) printf "%s%.9f", (i > 1 ? ", " : ""), $i
+    printf "]}"
+  }'
+}
+
+# Run the suite and print its JSON document, one result per line.
+suite() {
+  printf '{"date": "%s", "host": "%s",\n "results": [\n' \
+         "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -n)"
+  sep=
+  for prog in fib nqueens qsort; do
+    if [ ! -x "$bindir/$prog" ]; then
+      echo "$bindir/$prog not found; skipping $prog" >&2
+      continue
+    fi
+    case $prog in
+      fib) sizes=$BENCH_FIB ;;
+      nqueens) sizes=$BENCH_NQUEENS ;;
+      qsort) sizes=$BENCH_QSORT ;;
+    esac
+    for n in $sizes; do
+      for p in $workers; do
+        if line=$(run "$prog" "$n" "$p"); then
+          printf '%s%s' "$sep" "$line"
+          sep=',
+'
+        fi
+      done
+    done
+  done
+  printf '\n]}\n'
+}
+
+# Compare results file $2 against baseline $1; print one row per benchmark
+# of the baseline and exit with 1 if any regressed.
+compare() {
+  awk -v alpha="$alpha" -v threshold="$threshold" '
+    # result lines look like {"program": "fib", "n": 35, "workers": 1,
+    # "times_sec": [...]}; the first operand is the baseline (index 1), so
+    # that a file can be compared against itself
+    /"times_sec"/ {
+      base = (FNR == NR)
+      line = $0
+      gsub(/[{}\[\]",:]/, " ", line)
+      split(line, f, " ")
+      key = f[2] " " f[4] " " f[6]
+      m = 0
+      for (i = 8; i in f; i++) sample[base, key, ++m] = f[i]
+      size[base, key] = m
+      if (base) order[++nkeys] = key
+    }
+
+    function median(which, key,    m, i, j, x, v) {
+      m = size[which, key]
+      for (i = 1; i <= m; i++) v[i] = sample[which, key, i]
+      for (i = 2; i <= m; i++) {
+        x = v[i]
+        for (j = i - 1; j >= 1 && v[j] > x; j--) v[j + 1] = v[j]
+        v[j + 1] = x
+      }
+      return (m % 2) ? v[(m + 1) / 2] : (v[m / 2] + v[m / 2 + 1]) / 2
+    }
+
+    # upper tail of the standard normal distribution
+    function normal_sf(z,    t, y) {
+      if (z < 0) return 1 - normal_sf(-z)
+      t = 1 / (1 + 0.2316419 * z)
+      y = t * (0.319381530 + t * (-0.356563782 + t * (1.781477937 \
+          + t * (-1.821255978 + t * 1.330274429))))
+      return y * exp(-z * z / 2) / sqrt(2 * 3.14159265358979)
+    }
+
+    # one-sided p-value that the current times (index 0) are stochastically
+    # larger than the baseline times (index 1): normal approximation of
+    # Mann-Whitney U with tie and continuity corrections
+    function mann_whitney(key,    n0, n1, i, j, x, v, w, k, r, ties, u, mu,
+                          sd) {
+      n0 = size[1, key]
+      n1 = size[0, key]
+      k = 0
+      for (i = 1; i <= n0; i++) { v[++k] = sample[1, key, i]; w[k] = 0 }
+      for (i = 1; i <= n1; i++) { v[++k] = sample[0, key, i]; w[k] = 1 }
+      for (i = 2; i <= k; i++) {
+        x = v[i]; r = w[i]
+        for (j = i - 1; j >= 1 && v[j] > x; j--) {
+          v[j + 1] = v[j]; w[j + 1] = w[j]
+        }
+        v[j + 1] = x; w[j + 1] = r
+      }
+      u = 0
+      ties = 0
+      for (i = 1; i <= k; i = j) {
+        for (j = i; j <= k && v[j] == v[i]; j++) ;
+        r = (i + j - 1) / 2
+        for (x = i; x < j; x++) if (w[x]) u += r
+        ties += (j - i) ^ 3 - (j - i)
+      }
+      u -= n1 * (n1 + 1) / 2
+      mu = n0 * n1 / 2
+      sd = sqrt(n0 * n1 / 12 * ((k + 1) - ties / (k * (k - 1))))
+      return sd > 0 ? normal_sf((u - mu - 0.5) / sd) : 1
+    }
+
+    END {
+      printf "%-8s %10s %7s %12s %12s %8s %8s  %s\n", "program", "n",
+             "workers", "base_median", "median", "change", "p", "verdict" \
+             > "/dev/stderr"
+      status = 0
+      for (i = 1; i <= nkeys; i++) {
+        key = order[i]
+        split(key, f, " ")
+        if (!((0, key) in size)) {
+          printf "%-8s %10s %7s %12.6f %12s %8s %8s  %s\n", f[1], f[2],
+                 f[3], median(1, key), "-", "-", "-", "missing" \
+                 > "/dev/stderr"
+          continue
+        }
+        b = median(1, key)
+        c = median(0, key)
+        change = b > 0 ? c / b - 1 : 0
+        p = mann_whitney(key)
+        verdict = "ok"
+        if (p < alpha && change > threshold) {
+          verdict = "REGRESSION"
+          status = 1
+        } else if (1 - p < alpha && change < -threshold) {
+          verdict = "faster"
+        }
+        printf "%-8s %10s %7s %12.6f %12.6f %+7.1f%% %8.4f  %s\n", f[1],
+               f[2], f[3], b, c, 100 * change, p, verdict > "/dev/stderr"
+      }
+      exit status
+    }' "$1" "$2"
+}
+
+if [ -z "$results" ]; then
+  if [ -n "$out" ]; then
+    suite > "$out" || exit 1
+    results=$out
+  elif [ -n "$baseline" ]; then
+    results=${TMPDIR:-/tmp}/bench.$$.json
+    trap 'rm -f "$results"' EXIT
+    suite > "$results" || exit 1
+    cat "$results"
+  else
+    suite
+    exit
+  fi
+fi
+
+if [ -n "$baseline" ]; then
+  compare "$baseline" "$results"
+fi
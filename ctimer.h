@@ -4,10 +4,13 @@
  * [Include-only header library]
  * C/C++ timer utilities using POSIX `clock_gettime()`.
  *
+ * Optional cycle-counter clock backend (`CTIMER_TSC`) and hardware
+ * performance counters (`CTIMER_PERF`).
+ *
  * @sa <https://github.com/sillycross/mlpds/blob/master/fasttime.h>
  *
  * @file        ctimer.h
- * @version     1.0.0
+ * @version     1.2.0
  * @author      Alexandros-Stavros Iliopoulos
  * @license     MIT
  * @copyright   Copyright (c) 2021 Supertech Research Group, CSAIL, MIT
@@ -60,6 +63,32 @@
  * - `ctimer_lap()`     :: accumulate elapsed time between start & stop
  * - `ctimer_print()`   :: print elapsed time in sec with fixed format
  *
+ * Lap accumulator utilities
+ * - `ctimer_sum_t`       :: type of CTimer lap-sum struct
+ * - `ctimer_sum_reset()` :: zero out lap sum
+ * - `ctimer_sum_add()`   :: add time between stopwatch start & stop
+ * - `ctimer_sum_merge()` :: add one lap sum into another
+ * - `ctimer_sum_print()` :: print summed time and lap count
+ *
+ * Lap statistics utilities
+ * - `ctimer_stats_t`             :: type of CTimer lap histogram struct
+ * - `ctimer_stats_reset()`       :: clear histogram
+ * - `ctimer_stats_record()`      :: record time between stopwatch start & stop
+ * - `ctimer_stats_record_nsec()` :: record a time in nsec
+ * - `ctimer_stats_merge()`       :: add one histogram into another
+ * - `ctimer_stats_percentile()`  :: approximate percentile in nsec
+ * - `ctimer_stats_mean()`        :: mean recorded time in nsec
+ * - `ctimer_stats_print()`       :: print count, p50/p99/p999 and max
+ *
+ * Performance counter utilities (with `CTIMER_PERF`)
+ * - `ctimer_perf_t`       :: type of CTimer counter set struct
+ * - `ctimer_perf_init()`  :: select counted events
+ * - `ctimer_perf_start()` :: open and start counters on all threads
+ * - `ctimer_perf_stop()`  :: stop counters and sum them over threads
+ * - `ctimer_perf_count()` :: count of one event
+ * - `ctimer_perf_name()`  :: name of the i-th counted event
+ * - `ctimer_perf_print()` :: print counts, IPC and misses per element
+ *
  * Timespec struct utilities
  * - `timespec_sub()`   :: calculate difference between 2 timespecs
  * - `timespec_add()`   :: calculate sum of 2 timespecs
@@ -93,6 +122,79 @@
  * `ctimer_stop()` also calls `ctimer_measure()` internally to calculate and
  * store the elapsed time in the input `ctimer_t` object.
  *
+ * @subsection tsc Cycle-counter clock backend
+ *
+ * If the preprocessor macro `CTIMER_TSC` is defined, then `ctimer_start()` and
+ * `ctimer_stop()` read the CPU's cycle counter instead of calling
+ * `clock_gettime()`: `rdtscp` on x86 and `cntvct_el0` on AArch64.  Counter
+ * ticks are converted to `CLOCK_MONOTONIC`-based timespecs with a fixed-point
+ * scale factor, so the rest of the API is unchanged.  On x86 the scale factor
+ * is calibrated against `CLOCK_MONOTONIC` for `CTIMER_TSC_CALIBRATION_NSEC`
+ * nanoseconds (10 msec by default); on AArch64 it is computed from the
+ * counter frequency in `cntfrq_el0`.  With GCC or Clang this happens once at
+ * program startup; otherwise, call `ctimer_calibrate()` before the first
+ * measurement.
+ *
+ * The x86 backend assumes an invariant TSC, i.e., one that ticks at a
+ * constant rate and in sync across cores (`constant_tsc` and `nonstop_tsc`
+ * in `/proc/cpuinfo` on Linux).
+ *
+ * @subsection sums Summing laps across threads and Cilk tasks
+ *
+ * A `ctimer_t` stopwatch belongs to one thread of execution: lapping a shared
+ * stopwatch from concurrent threads or Cilk tasks is a data race.  Instead,
+ * time each lap with a stopwatch local to the task, and add it to a
+ * `ctimer_sum_t` lap sum with `ctimer_sum_add()`.  In Cilk programs, declare
+ * the lap sum as a reducer, so each worker updates its own view without
+ * atomics and the views are merged as the computation syncs:
+ *
+ * ```
+ * ctimer_sum_t cilk_reducer(ctimer_sum_identity, ctimer_sum_reduce) phase;
+ * ```
+ *
+ * (A pointer to the reducer, e.g. `&phase`, refers to the current view and
+ * must not be held across a `cilk_spawn` or `cilk_sync`.)  Elsewhere, give
+ * each thread its own lap sum and combine them with `ctimer_sum_merge()`.
+ *
+ * @subsection stats Lap statistics
+ *
+ * A `ctimer_stats_t` histogram records many laps in bounded memory: times are
+ * counted in log-linear buckets (as in HdrHistogram), exact below
+ * 2^`CTIMER_STATS_PRECISION` nsec and with relative error below
+ * 2^-`CTIMER_STATS_PRECISION` above that, up to 2^`CTIMER_STATS_MAX_LOG2`
+ * nsec.  Longer times land in the last bucket, but the exact minimum, maximum
+ * and sum are tracked as well.  Recording a lap costs a few integer
+ * instructions and no allocation.
+ *
+ * Histograms are not thread-safe; give each thread its own and combine them
+ * with `ctimer_stats_merge()`.  `ctimer_stats_identity()` and
+ * `ctimer_stats_reduce()` have the callback signatures of a Cilk reducer.
+ *
+ * @subsection perf Hardware performance counters
+ *
+ * If the preprocessor macro `CTIMER_PERF` is defined (Linux only), a
+ * `ctimer_perf_t` counter set reads hardware and software events with
+ * `perf_event_open()` across a timed region: cycles, instructions, LLC
+ * misses and branch misses by default, or the comma-separated list in the
+ * `CTIMER_PERF_EVENTS` environment variable.  `ctimer_perf_start()` opens a
+ * counter per event on every thread of the process, so the counts cover all
+ * Cilk workers, and `ctimer_perf_stop()` sums them:
+ *
+ * ```
+ * ctimer_perf_t p;
+ * ctimer_perf_init(&p, NULL);
+ * ctimer_perf_start(&p);
+ * ctimer_start(&t);
+ * kernel();
+ * ctimer_stop(&t);
+ * ctimer_perf_stop(&p);
+ * ctimer_perf_print(&p, "kernel", n);
+ * ```
+ *
+ * Only user-space events are counted, which `perf_event_paranoid` levels up
+ * to 2 allow.  If the counters cannot be opened, `ctimer_perf_print()` says
+ * why instead of printing counts.
+ *
  * @subsection example Example usage in C/C++
  *
  * @snippet ctimer_example.c ctimer_example
@@ -106,6 +208,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
 
 /**
@@ -269,6 +373,114 @@ long timespec_nsec(
 /** @} */ /* end group ctimer_timespec */
 
 
+/* ==================================================
+ * CLOCK BACKEND
+ * ================================================== */
+
+
+#ifdef CTIMER_TSC
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif !defined(__aarch64__)
+#error "CTIMER_TSC is only supported on x86 and AArch64"
+#endif
+
+/** Duration of the x86 TSC calibration in nsec. */
+#ifndef CTIMER_TSC_CALIBRATION_NSEC
+#define CTIMER_TSC_CALIBRATION_NSEC (10 * 1000 * 1000)
+#endif
+
+/* tick-to-timespec conversion: ns = ns0 + ((ticks - tsc0) * mult) >> 32 */
+static struct {
+    uint64_t tsc0;              /* counter value at calibration */
+    uint64_t ns0;               /* CLOCK_MONOTONIC nsec at calibration */
+    uint64_t mult;              /* nsec per tick, 32.32 fixed point */
+} _ctimer_tsc;
+
+
+/* read the cycle counter */
+static inline
+uint64_t _ctimer_read_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int aux;
+    return __rdtscp(&aux);
+#else
+    uint64_t v;
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(v) :: "memory");
+    return v;
+#endif
+}
+
+
+static inline
+uint64_t _ctimer_monotonic_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * _NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * Calibrate the cycle-counter clock backend against `CLOCK_MONOTONIC`.
+ *
+ * @note Only defined with `CTIMER_TSC`.  Called automatically at program
+ * startup when compiled with GCC or Clang.
+ */
+static inline
+void ctimer_calibrate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns0 = _ctimer_monotonic_nsec();
+    uint64_t tsc0 = _ctimer_read_tsc();
+    uint64_t ns1, tsc1;
+    do {
+        ns1 = _ctimer_monotonic_nsec();
+        tsc1 = _ctimer_read_tsc();
+    } while (ns1 - ns0 < CTIMER_TSC_CALIBRATION_NSEC);
+    _ctimer_tsc.mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+#else
+    uint64_t freq;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+    _ctimer_tsc.mult = ((uint64_t)_NSEC_PER_SEC << 32) / freq;
+    uint64_t ns0 = _ctimer_monotonic_nsec();
+    uint64_t tsc0 = _ctimer_read_tsc();
+#endif
+    _ctimer_tsc.ns0 = ns0;
+    _ctimer_tsc.tsc0 = tsc0;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor))
+static void _ctimer_calibrate_at_startup(void) {
+    ctimer_calibrate();
+}
+#endif
+
+#endif  /* CTIMER_TSC */
+
+
+/* read the current time of the CTimer clock */
+static inline
+void _ctimer_now(
+    struct timespec * ts        /**<[out] current time */
+) {
+#ifdef CTIMER_TSC
+    uint64_t ticks = _ctimer_read_tsc() - _ctimer_tsc.tsc0;
+#ifdef __SIZEOF_INT128__
+    uint64_t ns = _ctimer_tsc.ns0
+        + (uint64_t)(((unsigned __int128)ticks * _ctimer_tsc.mult) >> 32);
+#else
+    uint64_t ns = _ctimer_tsc.ns0
+        + (uint64_t)((double)ticks * (double)_ctimer_tsc.mult / 4294967296.0);
+#endif
+    ts->tv_sec = (time_t)(ns / _NSEC_PER_SEC);
+    ts->tv_nsec = (long)(ns % _NSEC_PER_SEC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, ts);
+#endif
+}
+
+
 /* ==================================================
  * STOPWATCH API
  * ================================================== */
@@ -284,7 +496,8 @@ long timespec_nsec(
 
 
 /**
- * Stopwatch timer struct using `clock_gettime()`.
+ * Stopwatch timer struct using `clock_gettime()` (or the cycle counter, with
+ * `CTIMER_TSC`).
  */
 typedef struct {
     struct timespec start;      /**< Stopwatch start time  */
@@ -371,7 +584,7 @@ static inline
 void ctimer_start(
     ctimer_t * t                /**<[in,out] stopwatch pointer */
 ) {
-    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    _ctimer_now(&t->start);
 }
 
 
@@ -391,7 +604,7 @@ static inline
 void ctimer_stop(
     ctimer_t * t                /**<[in,out] stopwatch pointer */
 ) {
-    clock_gettime(CLOCK_MONOTONIC, &t->end);
+    _ctimer_now(&t->end);
 #ifdef CTIMER_MEASURE_ON_STOP
     ctimer_measure(t);
 #endif
@@ -433,6 +646,748 @@ void ctimer_print(
 /** @} */ /* end group ctimer_stopwatch */
 
 
+/* ==================================================
+ * LAP-SUM API
+ * ================================================== */
+
+
+/**
+ * @defgroup ctimer_sum Lap-Sum API
+ *
+ * Functions for summing laps from many stopwatches, e.g., of concurrent
+ * threads or Cilk tasks.
+ *
+ * @{
+ */
+
+
+/**
+ * Sum of lap times.
+ */
+typedef struct {
+    struct timespec elapsed;    /**< Total time of all laps */
+    uint64_t        laps;       /**< Number of laps */
+} ctimer_sum_t;
+
+
+/**
+ * Zero out a `ctimer_sum_t` lap sum.
+ */
+static inline
+void ctimer_sum_reset(
+    ctimer_sum_t * s            /**<[out] lap sum pointer */
+) {
+    s->elapsed = (struct timespec){0};
+    s->laps = 0;
+}
+
+
+/**
+ * Add the time between the start and end of a stopped `ctimer_t` stopwatch to
+ * a `ctimer_sum_t` lap sum.  The `elapsed` field of the stopwatch is neither
+ * used nor modified.
+ *
+ * @sa ctimer_start
+ * @sa ctimer_stop
+ */
+static inline
+void ctimer_sum_add(
+    ctimer_sum_t       * s,     /**<[in,out] lap sum pointer */
+    ctimer_t     const * t      /**<[in]     stopped stopwatch pointer */
+) {
+    /* elapsed += end - start */
+    timespec_add(&s->elapsed, s->elapsed, t->end);
+    timespec_sub(&s->elapsed, s->elapsed, t->start);
+    s->laps++;
+}
+
+
+/**
+ * Add the lap sum `src` to the lap sum `dst`.
+ */
+static inline
+void ctimer_sum_merge(
+    ctimer_sum_t       * dst,   /**<[in,out] lap sum to merge into */
+    ctimer_sum_t const * src    /**<[in]     lap sum to merge from */
+) {
+    timespec_add(&dst->elapsed, dst->elapsed, src->elapsed);
+    dst->laps += src->laps;
+}
+
+
+/**
+ * Cilk reducer identity callback: zero out the `ctimer_sum_t` at `view`.
+ */
+static inline
+void ctimer_sum_identity(
+    void * view                 /**<[out] lap sum pointer */
+) {
+    ctimer_sum_reset((ctimer_sum_t *)view);
+}
+
+
+/**
+ * Cilk reducer reduce callback: add the `ctimer_sum_t` at `right` to the one
+ * at `left`.
+ */
+static inline
+void ctimer_sum_reduce(
+    void * left,                /**<[in,out] lap sum to merge into */
+    void * right                /**<[in]     lap sum to merge from */
+) {
+    ctimer_sum_merge((ctimer_sum_t *)left, (ctimer_sum_t const *)right);
+}
+
+
+/**
+ * Print a line with the summed time of a `ctimer_sum_t` in seconds and the
+ * number of laps.
+ *
+ * The line is printed as:
+ * ```
+ * Time(<label>) = XX.XXXXXXXXX sec in N laps
+ * ```
+ *
+ * If `label` is `NULL` or the empty string, the "(<label>)" tag is omitted
+ * from the printed output.
+ */
+static inline
+void ctimer_sum_print(
+    ctimer_sum_t const   s,     /**<[in] lap sum */
+    char         const * label  /**<[in] label/description for printed time */
+) {
+    if ((label != NULL) && (label[0] != '\0'))
+        printf("Time(%s) = ", label);
+    else
+        printf("Time = ");
+
+    printf("%ld.%09ld sec in %llu laps\n", (long)s.elapsed.tv_sec,
+           s.elapsed.tv_nsec, (unsigned long long)s.laps);
+}
+
+
+/** @} */ /* end group ctimer_sum */
+
+
+/* ==================================================
+ * STATISTICS API
+ * ================================================== */
+
+
+/**
+ * @defgroup ctimer_stats Statistics API
+ *
+ * Functions for collecting percentile statistics of many laps.
+ *
+ * @{
+ */
+
+
+/**
+ * Number of bits of linear sub-buckets per power of two in `ctimer_stats_t`
+ * histograms.  Times are recorded with relative error below
+ * 2^-`CTIMER_STATS_PRECISION`.
+ */
+#ifndef CTIMER_STATS_PRECISION
+#define CTIMER_STATS_PRECISION 5
+#endif
+
+/**
+ * Base-2 logarithm of the longest time (in nsec) that `ctimer_stats_t`
+ * histograms resolve; the default covers about 18 minutes.
+ */
+#ifndef CTIMER_STATS_MAX_LOG2
+#define CTIMER_STATS_MAX_LOG2 40
+#endif
+
+/** Number of buckets in a `ctimer_stats_t` histogram. */
+#define CTIMER_STATS_BUCKETS \
+    ((CTIMER_STATS_MAX_LOG2 - CTIMER_STATS_PRECISION + 1) \
+     << CTIMER_STATS_PRECISION)
+
+
+/**
+ * Log-linear histogram of lap times.
+ */
+typedef struct {
+    uint64_t count;             /**< Number of recorded laps */
+    uint64_t min;               /**< Shortest lap in nsec */
+    uint64_t max;               /**< Longest lap in nsec */
+    uint64_t sum;               /**< Total time of all laps in nsec */
+    uint64_t buckets[CTIMER_STATS_BUCKETS]; /**< Lap counts per bucket */
+} ctimer_stats_t;
+
+
+/* index of the most significant set bit of v > 0 */
+static inline
+int _ctimer_msb(
+    uint64_t v
+) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(v);
+#else
+    int b = 0;
+    while (v >>= 1)
+        b++;
+    return b;
+#endif
+}
+
+
+/* histogram bucket of a time in nsec */
+static inline
+int _ctimer_stats_bucket(
+    uint64_t ns
+) {
+    if (ns < ((uint64_t)1 << CTIMER_STATS_PRECISION))
+        return (int)ns;
+    int b = _ctimer_msb(ns);
+    if (b >= CTIMER_STATS_MAX_LOG2)
+        return CTIMER_STATS_BUCKETS - 1;
+    int shift = b - CTIMER_STATS_PRECISION;
+    return ((shift + 1) << CTIMER_STATS_PRECISION)
+        + (int)((ns >> shift) & (((uint64_t)1 << CTIMER_STATS_PRECISION) - 1));
+}
+
+
+/* smallest time in nsec that falls in histogram bucket i */
+static inline
+uint64_t _ctimer_stats_bucket_low(
+    int i
+) {
+    int shift = (i >> CTIMER_STATS_PRECISION) - 1;
+    if (shift < 0)
+        return (uint64_t)i;
+    uint64_t sub = (uint64_t)(i & ((1 << CTIMER_STATS_PRECISION) - 1));
+    return (((uint64_t)1 << CTIMER_STATS_PRECISION) + sub) << shift;
+}
+
+
+/**
+ * Clear a `ctimer_stats_t` histogram.
+ *
+ * @warning Histograms must be reset before their first use.
+ */
+static inline
+void ctimer_stats_reset(
+    ctimer_stats_t * s          /**<[out] histogram pointer */
+) {
+    memset(s, 0, sizeof(*s));
+    s->min = UINT64_MAX;
+}
+
+
+/**
+ * Record a lap of `ns` nanoseconds in a `ctimer_stats_t` histogram.
+ */
+static inline
+void ctimer_stats_record_nsec(
+    ctimer_stats_t * s,         /**<[in,out] histogram pointer */
+    uint64_t const   ns         /**<[in]     lap time in nsec */
+) {
+    s->count++;
+    s->sum += ns;
+    if (ns < s->min)
+        s->min = ns;
+    if (ns > s->max)
+        s->max = ns;
+    s->buckets[_ctimer_stats_bucket(ns)]++;
+}
+
+
+/**
+ * Record the time between the start and end of a stopped `ctimer_t`
+ * stopwatch as a lap in a `ctimer_stats_t` histogram.  The `elapsed` field
+ * of the stopwatch is neither used nor modified.
+ *
+ * @sa ctimer_start
+ * @sa ctimer_stop
+ */
+static inline
+void ctimer_stats_record(
+    ctimer_stats_t       * s,   /**<[in,out] histogram pointer */
+    ctimer_t       const * t    /**<[in]     stopped stopwatch pointer */
+) {
+    struct timespec lap;
+    timespec_sub(&lap, t->end, t->start);
+    long ns = timespec_nsec(lap);
+    ctimer_stats_record_nsec(s, ns > 0 ? (uint64_t)ns : 0);
+}
+
+
+/**
+ * Add the laps recorded in histogram `src` to histogram `dst`, e.g. to
+ * combine per-thread histograms.
+ */
+static inline
+void ctimer_stats_merge(
+    ctimer_stats_t       * dst, /**<[in,out] histogram to merge into */
+    ctimer_stats_t const * src  /**<[in]     histogram to merge from */
+) {
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    for (int i = 0; i < CTIMER_STATS_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+
+/**
+ * Cilk reducer identity callback: reset the `ctimer_stats_t` at `view`.
+ */
+static inline
+void ctimer_stats_identity(
+    void * view                 /**<[out] histogram pointer */
+) {
+    ctimer_stats_reset((ctimer_stats_t *)view);
+}
+
+
+/**
+ * Cilk reducer reduce callback: merge the `ctimer_stats_t` at `right` into
+ * the one at `left`.
+ */
+static inline
+void ctimer_stats_reduce(
+    void * left,                /**<[in,out] histogram to merge into */
+    void * right                /**<[in]     histogram to merge from */
+) {
+    ctimer_stats_merge((ctimer_stats_t *)left, (ctimer_stats_t const *)right);
+}
+
+
+/**
+ * Return the approximate `p`-th percentile (0 <= `p` <= 100) of the laps
+ * recorded in a `ctimer_stats_t` histogram, in nsec.  The result is the
+ * midpoint of the bucket that holds the percentile, clamped to the recorded
+ * minimum and maximum; `ctimer_stats_percentile(s, 100)` is the exact
+ * maximum.
+ *
+ * @return percentile in nsec (0 if no laps were recorded)
+ */
+static inline
+uint64_t ctimer_stats_percentile(
+    ctimer_stats_t const * s,   /**<[in] histogram pointer */
+    double         const   p    /**<[in] percentile in [0, 100] */
+) {
+    if (s->count == 0)
+        return 0;
+    if (p >= 100.0)
+        return s->max;
+
+    /* rank of the percentile among the recorded laps (1-based) */
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)s->count);
+    if ((double)rank < p / 100.0 * (double)s->count)
+        rank++;
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < CTIMER_STATS_BUCKETS; i++) {
+        seen += s->buckets[i];
+        if (seen >= rank) {
+            uint64_t lo = _ctimer_stats_bucket_low(i);
+            uint64_t hi = (i + 1 < CTIMER_STATS_BUCKETS)
+                ? _ctimer_stats_bucket_low(i + 1) : s->max + 1;
+            uint64_t v = lo + (hi - lo - 1) / 2;
+            if (v < s->min)
+                v = s->min;
+            if (v > s->max)
+                v = s->max;
+            return v;
+        }
+    }
+    return s->max;
+}
+
+
+/**
+ * Return the mean lap time recorded in a `ctimer_stats_t` histogram, in nsec.
+ *
+ * @return mean in nsec (0 if no laps were recorded)
+ */
+static inline
+double ctimer_stats_mean(
+    ctimer_stats_t const * s    /**<[in] histogram pointer */
+) {
+    return (s->count > 0) ? (double)s->sum / (double)s->count : 0.0;
+}
+
+
+/**
+ * Print a line with the number of laps and the p50, p99, p999 and maximum lap
+ * times recorded in a `ctimer_stats_t` histogram, in seconds.
+ *
+ * The line is printed as:
+ * ```
+ * Stats(<label>) = N laps: p50 X.XXXXXXXXX, p99 X.XXXXXXXXX, p999 X.XXXXXXXXX, max X.XXXXXXXXX sec
+ * ```
+ *
+ * If `label` is `NULL` or the empty string, the "(<label>)" tag is omitted
+ * from the printed output.
+ */
+static inline
+void ctimer_stats_print(
+    ctimer_stats_t const * s,     /**<[in] histogram pointer */
+    char           const * label  /**<[in] label/description for printed stats */
+) {
+    if ((label != NULL) && (label[0] != '\0'))
+        printf("Stats(%s) = ", label);
+    else
+        printf("Stats = ");
+
+    printf("%llu laps: p50 %.9f, p99 %.9f, p999 %.9f, max %.9f sec\n",
+           (unsigned long long)s->count,
+           (double)ctimer_stats_percentile(s, 50.0) / _NSEC_PER_SEC,
+           (double)ctimer_stats_percentile(s, 99.0) / _NSEC_PER_SEC,
+           (double)ctimer_stats_percentile(s, 99.9) / _NSEC_PER_SEC,
+           (double)s->max / _NSEC_PER_SEC);
+}
+
+
+/** @} */ /* end group ctimer_stats */
+
+
+/* ==================================================
+ * PERFORMANCE COUNTER API
+ * ================================================== */
+
+
+#ifdef CTIMER_PERF
+
+#ifndef __linux__
+#error "CTIMER_PERF requires Linux perf_event_open()"
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+/**
+ * @defgroup ctimer_perf Performance Counter API
+ *
+ * Functions for reading hardware performance counters of every thread of the
+ * process across a timed region.  Only defined with `CTIMER_PERF`.
+ *
+ * @{
+ */
+
+
+/** Maximum number of events counted by one `ctimer_perf_t`. */
+#ifndef CTIMER_PERF_MAX_EVENTS
+#define CTIMER_PERF_MAX_EVENTS 8
+#endif
+
+/** Events counted when neither the caller nor `CTIMER_PERF_EVENTS` set any. */
+#define CTIMER_PERF_DEFAULT_EVENTS "cycles,instructions,llc-misses,branch-misses"
+
+
+/* events known to ctimer_perf_init() */
+static struct {
+    char const * name;
+    uint32_t     type;
+    uint64_t     config;
+} const _ctimer_perf_events[] = {
+    {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc-refs",      PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"llc-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branches",      PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"l1d-misses",    PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"dtlb-misses",   PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"page-faults",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"migrations",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+
+
+/**
+ * Counter set for one timed region.
+ */
+typedef struct {
+    int      nevents;           /**< Number of counted events */
+    int      event[CTIMER_PERF_MAX_EVENTS]; /**< Event table indices */
+    uint64_t count[CTIMER_PERF_MAX_EVENTS]; /**< Counts summed over threads */
+    int      nthreads;          /**< Number of threads being counted */
+    int    * fd;                /**< Counter fds, `nevents` per thread */
+    int      error;             /**< `errno` of the first failure, or 0 */
+} ctimer_perf_t;
+
+
+/* perf_event_open(2) has no glibc wrapper */
+static inline
+int _ctimer_perf_open(
+    int      event,             /**<[in] event table index */
+    pid_t    tid                /**<[in] thread to count */
+) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = _ctimer_perf_events[event].type;
+    attr.config = _ctimer_perf_events[event].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+
+/* close and free the counter fds of p */
+static inline
+void _ctimer_perf_close(
+    ctimer_perf_t * p           /**<[in,out] counter set pointer */
+) {
+    for (int i = 0; i < p->nthreads * p->nevents; i++)
+        close(p->fd[i]);
+    free(p->fd);
+    p->fd = NULL;
+    p->nthreads = 0;
+}
+
+
+/**
+ * Select the events counted by `p` from a comma-separated list of names:
+ * `cycles`, `instructions`, `llc-refs`, `llc-misses`, `branches`,
+ * `branch-misses`, `l1d-misses`, `dtlb-misses`, `page-faults`,
+ * `context-switches` and `migrations`.  If `events` is `NULL`, the list is
+ * read from the `CTIMER_PERF_EVENTS` environment variable, and defaults to
+ * `CTIMER_PERF_DEFAULT_EVENTS`.
+ *
+ * @return 0 on success; -1 on an unknown name or too many events, which also
+ * sets `p->error` to `EINVAL`.
+ */
+static inline
+int ctimer_perf_init(
+    ctimer_perf_t       * p,      /**<[out] counter set pointer */
+    char          const * events  /**<[in]  event names, or NULL */
+) {
+    memset(p, 0, sizeof(*p));
+    if (events == NULL)
+        events = getenv("CTIMER_PERF_EVENTS");
+    if (events == NULL || events[0] == '\0')
+        events = CTIMER_PERF_DEFAULT_EVENTS;
+
+    int const nknown =
+        sizeof(_ctimer_perf_events) / sizeof(_ctimer_perf_events[0]);
+    while (*events != '\0') {
+        size_t len = strcspn(events, ",");
+        int e = 0;
+        while (e < nknown && (strlen(_ctimer_perf_events[e].name) != len
+                              || strncmp(_ctimer_perf_events[e].name, events,
+                                         len) != 0))
+            e++;
+        if (e == nknown || p->nevents == CTIMER_PERF_MAX_EVENTS) {
+            fprintf(stderr, "ctimer: cannot count perf event '%.*s'\n",
+                    (int)len, events);
+            p->error = EINVAL;
+            return -1;
+        }
+        p->event[p->nevents++] = e;
+        events += len;
+        if (*events == ',')
+            events++;
+    }
+    return 0;
+}
+
+
+/**
+ * Open the counters of `p` on every thread of the process and start them.
+ * Call it right before `ctimer_start()`.  If a counter cannot be opened
+ * (e.g., the kernel lacks perf support or `perf_event_paranoid` forbids
+ * it), `p->error` is set and nothing is counted.
+ *
+ * @warning Threads created after `ctimer_perf_start()` are not counted.  In
+ * Cilk programs, the runtime must have started its workers, e.g. by running
+ * a spawn beforehand.
+ *
+ * @sa ctimer_perf_stop
+ */
+static inline
+void ctimer_perf_start(
+    ctimer_perf_t * p           /**<[in,out] counter set pointer */
+) {
+    memset(p->count, 0, sizeof(p->count));
+    if (p->error != 0)
+        return;
+
+    DIR * tasks = opendir("/proc/self/task");
+    if (tasks == NULL) {
+        p->error = errno;
+        return;
+    }
+    int capacity = 0;
+    struct dirent * ent;
+    while ((ent = readdir(tasks)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (p->nthreads == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            int * fd = (int *)realloc(p->fd, (size_t)capacity * p->nevents
+                                      * sizeof(int));
+            if (fd == NULL) {
+                p->error = ENOMEM;
+                break;
+            }
+            p->fd = fd;
+        }
+        pid_t tid = (pid_t)atoi(ent->d_name);
+        int * fd = p->fd + p->nthreads * p->nevents;
+        int e = 0;
+        for (; e < p->nevents; e++) {
+            fd[e] = _ctimer_perf_open(p->event[e], tid);
+            if (fd[e] < 0)
+                break;
+        }
+        if (e < p->nevents) {
+            /* a thread that exited since readdir() is no loss */
+            int err = errno;
+            for (int i = 0; i < e; i++)
+                close(fd[i]);
+            if (err == ESRCH)
+                continue;
+            p->error = err;
+            break;
+        }
+        p->nthreads++;
+    }
+    closedir(tasks);
+    if (p->error != 0) {
+        _ctimer_perf_close(p);
+        return;
+    }
+
+    for (int i = 0; i < p->nthreads * p->nevents; i++)
+        ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+    for (int i = 0; i < p->nthreads * p->nevents; i++)
+        ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+
+/**
+ * Stop the counters of `p`, sum each event over all threads into
+ * `p->count`, and close them.  Call it right after `ctimer_stop()`.  Counts
+ * of events that the kernel multiplexed are scaled up to the whole region.
+ *
+ * @sa ctimer_perf_start
+ */
+static inline
+void ctimer_perf_stop(
+    ctimer_perf_t * p           /**<[in,out] counter set pointer */
+) {
+    for (int i = 0; i < p->nthreads * p->nevents; i++)
+        ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (int i = 0; i < p->nthreads * p->nevents; i++) {
+        uint64_t v[3];          /* value, time enabled, time running */
+        if (read(p->fd[i], v, sizeof(v)) != (ssize_t)sizeof(v) || v[2] == 0)
+            continue;
+        if (v[2] < v[1])
+            v[0] = (uint64_t)((double)v[0] * (double)v[1] / (double)v[2]);
+        p->count[i % p->nevents] += v[0];
+    }
+    _ctimer_perf_close(p);
+}
+
+
+/**
+ * Return the count of event `name` in `p`, or -1 if `p` does not count it
+ * (or could not).
+ */
+static inline
+double ctimer_perf_count(
+    ctimer_perf_t const * p,    /**<[in] counter set pointer */
+    char          const * name  /**<[in] event name */
+) {
+    if (p->error != 0)
+        return -1.0;
+    for (int e = 0; e < p->nevents; e++)
+        if (strcmp(_ctimer_perf_events[p->event[e]].name, name) == 0)
+            return (double)p->count[e];
+    return -1.0;
+}
+
+
+/**
+ * Return the name of the `i`-th event counted by `p`, whose count is
+ * `p->count[i]`, for 0 <= `i` < `p->nevents`.
+ */
+static inline
+char const * ctimer_perf_name(
+    ctimer_perf_t const * p,    /**<[in] counter set pointer */
+    int           const   i     /**<[in] event index */
+) {
+    return _ctimer_perf_events[p->event[i]].name;
+}
+
+
+/**
+ * Print a line with the counts of `p`, the instructions per cycle when both
+ * are counted, and the misses per element when `elements` > 0.
+ *
+ * The line is printed as:
+ * ```
+ * Counters(<label>) = cycles N, instructions N, ..., IPC X.XX, llc-misses/elem X.XXXX, ...
+ * ```
+ *
+ * or as `Counters(<label>) unavailable: <reason>` if the counters could not
+ * be read.  If `label` is `NULL` or the empty string, the "(<label>)" tag is
+ * omitted from the printed output.
+ */
+static inline
+void ctimer_perf_print(
+    ctimer_perf_t const * p,        /**<[in] counter set pointer */
+    char          const * label,    /**<[in] label/description for printed counts */
+    double        const   elements  /**<[in] elements processed, or 0 */
+) {
+    if ((label != NULL) && (label[0] != '\0'))
+        printf("Counters(%s)", label);
+    else
+        printf("Counters");
+
+    if (p->error != 0) {
+        printf(" unavailable: %s\n", strerror(p->error));
+        return;
+    }
+    printf(" =");
+    for (int e = 0; e < p->nevents; e++)
+        printf("%s %s %llu", e ? "," : "", _ctimer_perf_events[p->event[e]].name,
+               (unsigned long long)p->count[e]);
+
+    double cycles = ctimer_perf_count(p, "cycles");
+    double instructions = ctimer_perf_count(p, "instructions");
+    if (cycles > 0 && instructions >= 0)
+        printf(", IPC %.2f", instructions / cycles);
+    if (elements > 0) {
+        for (int e = 0; e < p->nevents; e++) {
+            char const * name = _ctimer_perf_events[p->event[e]].name;
+            size_t len = strlen(name);
+            if (len > 7 && strcmp(name + len - 7, "-misses") == 0)
+                printf(", %s/elem %.4f", name, (double)p->count[e] / elements);
+        }
+    }
+    printf("\n");
+}
+
+
+/** @} */ /* end group ctimer_perf */
+
+#endif  /* CTIMER_PERF */
+
+
 #ifdef __cplusplus
 } /* end extern "C" */
 #endif
@@ -0,0 +1,19 @@
+/* -*- c -*- */
+
+/*
+ * Serial elision of <cilk/cilk.h>, for building the tutorial programs with a
+ * plain C compiler (see the `serial` variant in the Makefile).  Spawns and
+ * syncs disappear, cilk_for becomes for, and reducers become ordinary
+ * variables, so each program runs as its serial elision.
+ */
+
+#ifndef __H_ELISION_CILK__
+#define __H_ELISION_CILK__
+
+#define cilk_spawn
+#define cilk_sync
+#define cilk_scope
+#define cilk_for for
+#define cilk_reducer(identity, reduce)
+
+#endif  /* __H_ELISION_CILK__ */
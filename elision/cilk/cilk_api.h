@@ -0,0 +1,13 @@
+/* -*- c -*- */
+
+/*
+ * Serial elision of <cilk/cilk_api.h>: one worker, numbered 0.
+ */
+
+#ifndef __H_ELISION_CILK_API__
+#define __H_ELISION_CILK_API__
+
+static inline unsigned __cilkrts_get_nworkers(void) { return 1; }
+static inline unsigned __cilkrts_get_worker_number(void) { return 0; }
+
+#endif  /* __H_ELISION_CILK_API__ */
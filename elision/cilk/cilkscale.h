@@ -0,0 +1,48 @@
+/* -*- c -*- */
+
+/*
+ * Serial elision of <cilk/cilkscale.h>: measurements are all zero and
+ * wsp_dump() prints nothing.
+ */
+
+#ifndef __H_ELISION_CILKSCALE__
+#define __H_ELISION_CILKSCALE__
+
+#include <stdint.h>
+
+typedef struct {
+    int64_t work;
+    int64_t span;
+    int64_t bspan;
+} wsp_t;
+
+static inline wsp_t wsp_getworkspan(void) {
+    wsp_t w = {0, 0, 0};
+    return w;
+}
+
+static inline wsp_t wsp_zero(void) {
+    wsp_t w = {0, 0, 0};
+    return w;
+}
+
+static inline wsp_t wsp_add(wsp_t lhs, wsp_t rhs) {
+    lhs.work += rhs.work;
+    lhs.span += rhs.span;
+    lhs.bspan += rhs.bspan;
+    return lhs;
+}
+
+static inline wsp_t wsp_sub(wsp_t lhs, wsp_t rhs) {
+    lhs.work -= rhs.work;
+    lhs.span -= rhs.span;
+    lhs.bspan -= rhs.bspan;
+    return lhs;
+}
+
+static inline void wsp_dump(wsp_t wsp, const char *tag) {
+    (void)wsp;
+    (void)tag;
+}
+
+#endif  /* __H_ELISION_CILKSCALE__ */
@@ -1,13 +1,30 @@
+#include <getopt.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 
 #include "ctimer.h"
+#include "instr.h"
 
-long fib(long n) {
+// Below this n, fib() runs fib_serial() instead of spawning.  The default
+// spawns all the way down to the leaves; -t keeps it at 2 or more, which
+// fib() relies on to stop at the leaves.
+static long fib_cutoff = 2;
+
+// The serial elision of fib().
+long fib_serial(long n) {
   if (n < 2)
     return n;
+  return fib_serial(n-1) + fib_serial(n-2);
+}
+
+long fib(long n) {
+  if (n < fib_cutoff)
+    return fib_serial(n);
   long x, y;
   cilk_scope {
     x = cilk_spawn fib(n-1);
@@ -16,20 +33,452 @@ long fib(long n) {
   return x + y;
 }
 
+// Largest n for which fib(n) fits in a long, and in an unsigned long.
+#define FIB_MAX_LONG 92
+#define FIB_MAX_ULONG 93
+
+// Fast doubling: with a = fib(k) and b = fib(k+1),
+//   fib(2k)   = a * (2b - a)
+//   fib(2k+1) = a^2 + b^2
+// which walks the bits of n from the top in O(log n) steps.  Unsigned
+// arithmetic wraps, so the result is fib(n) mod 2^64 for any n, and exact
+// up to FIB_MAX_ULONG.
+unsigned long fib_doubling(unsigned long n) {
+  unsigned long a = 0, b = 1;
+  for (int i = 63 - __builtin_clzl(n | 1); i >= 0; i--) {
+    unsigned long c = a * (2 * b - a);
+    unsigned long d = a * a + b * b;
+    if ((n >> i) & 1) {
+      a = d;
+      b = c + d;
+    } else {
+      a = c;
+      b = d;
+    }
+  }
+  return a;
+}
+
+// Big integers: little-endian arrays of 64-bit limbs.  The mpn_*
+// functions work on raw limb arrays of known length, bigint_t carries a
+// normalized length (no leading zero limbs).
+typedef uint64_t limb_t;
+typedef unsigned __int128 dlimb_t;
+
+typedef struct {
+  limb_t *d;
+  size_t n;
+} bigint_t;
+
+// Below this many limbs, Karatsuba falls back to schoolbook
+// multiplication.
+#define KARATSUBA_CUTOFF 32
+
+// At and above this many limbs, the three Karatsuba products are spawned.
+#define KARATSUBA_SPAWN_CUTOFF 256
+
+// r[0..an) = a[0..an) + b[0..bn), for an >= bn; returns the carry out.
+// r may alias a.
+static limb_t mpn_add(limb_t *r, const limb_t *a, size_t an, const limb_t *b,
+                      size_t bn) {
+  limb_t carry = 0;
+  for (size_t i = 0; i < an; i++) {
+    limb_t s = a[i] + carry;
+    carry = s < carry;
+    if (i < bn) {
+      s += b[i];
+      carry += s < b[i];
+    }
+    r[i] = s;
+  }
+  return carry;
+}
+
+// r[0..an) = a[0..an) - b[0..bn), for an >= bn; returns the borrow out.
+// r may alias a.
+static limb_t mpn_sub(limb_t *r, const limb_t *a, size_t an, const limb_t *b,
+                      size_t bn) {
+  limb_t borrow = 0;
+  for (size_t i = 0; i < an; i++) {
+    limb_t x = a[i];
+    limb_t y = (i < bn ? b[i] : 0) + borrow;
+    borrow = (y < borrow) | (x < y);
+    r[i] = x - y;
+  }
+  return borrow;
+}
+
+// r[0..an+bn) = a[0..an) * b[0..bn), schoolbook.
+static void mpn_mul_basecase(limb_t *r, const limb_t *a, size_t an,
+                             const limb_t *b, size_t bn) {
+  memset(r, 0, (an + bn) * sizeof(limb_t));
+  for (size_t i = 0; i < an; i++) {
+    limb_t carry = 0;
+    for (size_t j = 0; j < bn; j++) {
+      dlimb_t t = (dlimb_t) a[i] * b[j] + r[i + j] + carry;
+      r[i + j] = (limb_t) t;
+      carry = (limb_t) (t >> 64);
+    }
+    r[i + bn] = carry;
+  }
+}
+
+// r[0..2n) = a[0..n) * b[0..n), Karatsuba.  With a = a1 B^m + a0 and
+// b = b1 B^m + b0, the middle product a0 b1 + a1 b0 is
+// (a0 + a1)(b0 + b1) - a0 b0 - a1 b1, so each level does three
+// half-size multiplications instead of four.  On large operands they run
+// in parallel: a0 b0 and a1 b1 go straight into the disjoint halves of r.
+static void mpn_kmul(limb_t *r, const limb_t *a, const limb_t *b, size_t n) {
+  if (n < KARATSUBA_CUTOFF) {
+    mpn_mul_basecase(r, a, n, b, n);
+    return;
+  }
+
+  size_t m = n / 2;
+  size_t h = n - m;
+  limb_t *sa = malloc((4 * h + 4) * sizeof(limb_t));
+  limb_t *sb = sa + h + 1;
+  limb_t *z1 = sb + h + 1;
+
+  sa[h] = mpn_add(sa, a + m, h, a, m);
+  sb[h] = mpn_add(sb, b + m, h, b, m);
+
+  if (n >= KARATSUBA_SPAWN_CUTOFF) {
+    cilk_scope {
+      cilk_spawn mpn_kmul(r, a, b, m);
+      cilk_spawn mpn_kmul(r + 2 * m, a + m, b + m, h);
+      mpn_kmul(z1, sa, sb, h + 1);
+    }
+  } else {
+    mpn_kmul(r, a, b, m);
+    mpn_kmul(r + 2 * m, a + m, b + m, h);
+    mpn_kmul(z1, sa, sb, h + 1);
+  }
+
+  mpn_sub(z1, z1, 2 * h + 2, r, 2 * m);
+  mpn_sub(z1, z1, 2 * h + 2, r + 2 * m, 2 * h);
+  mpn_add(r + m, r + m, 2 * n - m, z1, 2 * h + 2);
+
+  free(sa);
+}
+
+static bigint_t bigint_alloc(size_t n) {
+  bigint_t x = {calloc(n ? n : 1, sizeof(limb_t)), n};
+  return x;
+}
+
+static void bigint_normalize(bigint_t *x) {
+  while (x->n > 0 && x->d[x->n - 1] == 0)
+    x->n--;
+}
+
+static bigint_t bigint_add(bigint_t a, bigint_t b) {
+  if (a.n < b.n) {
+    bigint_t t = a;
+    a = b;
+    b = t;
+  }
+  bigint_t r = bigint_alloc(a.n + 1);
+  r.d[a.n] = mpn_add(r.d, a.d, a.n, b.d, b.n);
+  bigint_normalize(&r);
+  return r;
+}
+
+// a - b, for a >= b.
+static bigint_t bigint_sub(bigint_t a, bigint_t b) {
+  bigint_t r = bigint_alloc(a.n);
+  mpn_sub(r.d, a.d, a.n, b.d, b.n);
+  bigint_normalize(&r);
+  return r;
+}
+
+static bigint_t bigint_mul(bigint_t a, bigint_t b) {
+  size_t n = a.n > b.n ? a.n : b.n;
+  bigint_t r = bigint_alloc(2 * n);
+  if (a.n == 0 || b.n == 0)
+    return (bigint_t) {r.d, 0};
+
+  // Karatsuba wants equal lengths: zero-pad the shorter operand.
+  limb_t *pad = NULL;
+  const limb_t *ad = a.d, *bd = b.d;
+  if (a.n != b.n) {
+    pad = calloc(n, sizeof(limb_t));
+    if (a.n < n) {
+      memcpy(pad, a.d, a.n * sizeof(limb_t));
+      ad = pad;
+    } else {
+      memcpy(pad, b.d, b.n * sizeof(limb_t));
+      bd = pad;
+    }
+  }
+  mpn_kmul(r.d, ad, bd, n);
+  free(pad);
+  bigint_normalize(&r);
+  return r;
+}
+
+// fib(n) by fast doubling on big integers.  The three products of each
+// step are independent and run in parallel, on top of the parallelism
+// inside each Karatsuba multiplication.
+bigint_t fib_bigint(unsigned long n) {
+  bigint_t a = bigint_alloc(1), b = bigint_alloc(1);
+  a.n = 0;
+  b.d[0] = 1;
+
+  for (int i = 63 - __builtin_clzl(n | 1); i >= 0; i--) {
+    bigint_t b2 = bigint_add(b, b);
+    bigint_t t = bigint_sub(b2, a);
+    bigint_t c, aa, bb;
+    cilk_scope {
+      c = cilk_spawn bigint_mul(a, t);
+      aa = cilk_spawn bigint_mul(a, a);
+      bb = bigint_mul(b, b);
+    }
+    bigint_t d = bigint_add(aa, bb);
+    free(b2.d);
+    free(t.d);
+    free(aa.d);
+    free(bb.d);
+    free(a.d);
+    free(b.d);
+    if ((n >> i) & 1) {
+      a = d;
+      b = bigint_add(c, d);
+      free(c.d);
+    } else {
+      a = c;
+      b = d;
+    }
+  }
+  free(b.d);
+  return a;
+}
+
+// Results with at most this many limbs are printed in full; larger ones
+// are summarized, since the schoolbook decimal conversion is quadratic.
+#define FIB_PRINT_LIMBS 16
+
+static void bigint_print(bigint_t x) {
+  if (x.n == 0) {
+    printf("0");
+    return;
+  }
+  // Peel off base-10^19 digits, least significant first.
+  const limb_t base = 10000000000000000000ULL;
+  limb_t *q = malloc(x.n * sizeof(limb_t));
+  limb_t *digits = malloc((2 * x.n + 1) * sizeof(limb_t));
+  size_t qn = x.n, nd = 0;
+  memcpy(q, x.d, x.n * sizeof(limb_t));
+  while (qn > 0) {
+    dlimb_t rem = 0;
+    for (size_t i = qn; i-- > 0;) {
+      dlimb_t cur = (rem << 64) | q[i];
+      q[i] = (limb_t) (cur / base);
+      rem = cur % base;
+    }
+    digits[nd++] = (limb_t) rem;
+    while (qn > 0 && q[qn - 1] == 0)
+      qn--;
+  }
+  printf("%lu", (unsigned long) digits[nd - 1]);
+  for (size_t i = nd - 1; i-- > 0;)
+    printf("%019lu", (unsigned long) digits[i]);
+  free(digits);
+  free(q);
+}
+
+enum engine {
+  ENGINE_NAIVE,     // fib(): exponential spawn tree, long results
+  ENGINE_DOUBLING,  // fib_doubling(): O(log n), results mod 2^64
+  ENGINE_BIGINT,    // fib_bigint(): exact, parallel Karatsuba
+  NUM_ENGINES
+};
+
+static const char *const engine_names[] = {"naive", "doubling", "bigint"};
+static const char *const engine_labels[] = {"fib", "fib_doubling",
+                                            "fib_bigint"};
+
+// With -e all, the naive engine only runs up to this n.
+#define FIB_NAIVE_ALL_MAX 40
+
+// Repetitions per threshold in a sweep; the fastest one is reported.
+#define SWEEP_REPS 3
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-e naive|doubling|bigint|all] [-t threshold] "
+                  "[-s] [n]\n", prog);
+  fprintf(stderr, "  -t <t>  naive engine: run fib_serial() below n = <t> >= 2 "
+                  "(default 2)\n");
+  fprintf(stderr, "  -s      sweep the naive engine's threshold and report "
+                  "time per spawn\n");
+}
+
+// Number of spawns fib(n) performs with the current fib_cutoff: one per
+// call at or above the cutoff.
+static long count_spawns(long n) {
+  long prev = 0, cur = 0;  // spawns of fib(k-1) and fib(k)
+  for (long k = 2; k <= n; k++) {
+    long next = (k < fib_cutoff) ? 0 : 1 + cur + prev;
+    prev = cur;
+    cur = next;
+  }
+  return cur;
+}
+
+// Fastest of SWEEP_REPS runs of f(n), in sec.
+static double best_time(long (*f)(long), long n) {
+  double best = 0;
+  for (int r = 0; r < SWEEP_REPS; r++) {
+    ctimer_t t;
+    ctimer_start(&t);
+    volatile long result = f(n);
+    (void) result;
+    ctimer_stop(&t);
+    ctimer_measure(&t);
+    double sec = timespec_sec(t.elapsed);
+    if (r == 0 || sec < best)
+      best = sec;
+  }
+  return best;
+}
+
+// Time the naive engine on n for thresholds from 2 up to n against the
+// serial elision Ts.  The overhead per spawn is (T - Ts) / spawns; the
+// T/Ts column is the parallel-over-serial ratio on the current workers,
+// so running the sweep with CILK_NWORKERS=1 gives T1/Ts and with more
+// workers TP/Ts.
+static void sweep_cutoff(long n) {
+  unsigned workers = __cilkrts_get_nworkers();
+  double ts = best_time(fib_serial, n);
+  printf("fib(%ld) on %u workers: Ts = %.6f sec (serial elision)\n", n,
+         workers, ts);
+  printf("%9s %12s %12s %12s %8s\n", "threshold", "spawns", "time_sec",
+         "ns_per_spawn", "T/Ts");
+  for (long c = 2; c <= n; c += 2) {
+    fib_cutoff = c;
+    long spawns = count_spawns(n);
+    double tp = best_time(fib, n);
+    double per_spawn = spawns ? (tp - ts) * 1e9 / spawns : 0;
+    printf("%9ld %12ld %12.6f %12.2f %8.3f\n", c, spawns, tp, per_spawn,
+           tp / ts);
+  }
+}
+
+// Run engine e on n, print its result and time, and return fib(n) mod
+// 2^64 for cross-checking the engines.
+static unsigned long run_engine(enum engine e, long n) {
+  unsigned long low = 0;
+  bigint_t big = {NULL, 0};
+
+  instr_t k;
+  instr_start(&k);
+
+  if (e == ENGINE_NAIVE)
+    low = fib(n);
+  else if (e == ENGINE_DOUBLING)
+    low = fib_doubling(n);
+  else
+    big = fib_bigint(n);
+
+  instr_stop(&k);
+
+  if (e == ENGINE_BIGINT) {
+    low = big.n ? big.d[0] : 0;
+    printf("fib(%ld) = ", n);
+    if (big.n <= FIB_PRINT_LIMBS) {
+      bigint_print(big);
+      printf("\n");
+    } else {
+      size_t bits = 64 * big.n - __builtin_clzl(big.d[big.n - 1]);
+      printf("<%zu bits, low 64 bits 0x%016lx>\n", bits, low);
+    }
+    free(big.d);
+  } else if (e == ENGINE_DOUBLING) {
+    printf(n > FIB_MAX_ULONG ? "fib(%ld) mod 2^64 = %lu\n" : "fib(%ld) = %lu\n",
+           n, low);
+  } else {
+    printf("fib(%ld) = %ld\n", n, (long) low);
+  }
+  // per-element counter rates are per spawn of the naive engine
+  instr_print(k, engine_labels[e], e == ENGINE_NAIVE ? count_spawns(n) : 0);
+  return low;
+}
+
 int main(int argc, char *argv[]) {
   long n = 10;
-  if (argc > 1)
-    n = atol(argv[1]);
+  int all = 0;
+  int sweep = 0;
+  enum engine engine = ENGINE_NAIVE;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:t:sh")) != -1) {
+    switch (opt) {
+    case 'e':
+      if (strcmp(optarg, "all") == 0) {
+        all = 1;
+        break;
+      }
+      engine = NUM_ENGINES;
+      for (int i = 0; i < NUM_ENGINES; i++) {
+        if (strcmp(optarg, engine_names[i]) == 0)
+          engine = (enum engine) i;
+      }
+      if (engine == NUM_ENGINES) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 't':
+      fib_cutoff = atol(optarg);
+      if (fib_cutoff < 2) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 's':
+      sweep = 1;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind < argc)
+    n = atol(argv[optind]);
 
-  ctimer_t t;
-  ctimer_start(&t);
+  if (n < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if ((sweep || (!all && engine == ENGINE_NAIVE)) && n > FIB_MAX_LONG) {
+    fprintf(stderr, "fib(%ld) overflows a long; use -e bigint.\n", n);
+    return 1;
+  }
 
-  long result = fib(n);
+  if (sweep) {
+    sweep_cutoff(n);
+    return 0;
+  }
 
-  ctimer_stop(&t);
-  ctimer_measure(&t);
+  if (!all) {
+    run_engine(engine, n);
+    return 0;
+  }
 
-  printf("fib(%ld) = %ld\n", n, result);
-  ctimer_print(t, "fib");
+  // Time every engine that is practical for n, and check that they agree
+  // on fib(n) mod 2^64.
+  int mismatch = 0;
+  unsigned long expect = run_engine(ENGINE_BIGINT, n);
+  if (run_engine(ENGINE_DOUBLING, n) != expect)
+    mismatch = 1;
+  if (n <= FIB_NAIVE_ALL_MAX && run_engine(ENGINE_NAIVE, n) != expect)
+    mismatch = 1;
+  if (mismatch) {
+    fprintf(stderr, "Engines disagree on fib(%ld).\n", n);
+    return 1;
+  }
   return 0;
 }
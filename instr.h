@@ -0,0 +1,254 @@
+/* -*- c -*- */
+
+/**
+ * [Include-only header library]
+ * Kernel instrumentation for the Cilk tutorial programs: wall-clock time with
+ * CTimer, plus work and span with Cilkscale and hardware counters with
+ * `CTIMER_PERF` when they are enabled.
+ *
+ * @file        instr.h
+ * @version     1.0.0
+ * @license     MIT
+ */
+
+
+/**
+ * @mainpage
+ *
+ * @section overview Overview
+ *
+ * Instr is an include-only header library that brackets a kernel with a
+ * CTimer stopwatch and, when the program is built with
+ * `-fcilktool=cilkscale`, a Cilkscale work/span measurement:
+ *
+ * ```
+ * instr_t k;
+ * instr_start(&k);
+ * kernel();
+ * instr_stop(&k);
+ * instr_print(k, "kernel", n);
+ * ```
+ *
+ * prints the `Time(kernel) = ...` line of `ctimer_print()` and, with
+ * Cilkscale, a `Parallelism(kernel) = ...` line with the parallelism and
+ * burdened parallelism, and dumps the measurement with `wsp_dump()`.
+ * Without Cilkscale the work/span half compiles to nothing, so the same
+ * source builds as a plain timed program.
+ *
+ * When the program is built with `-DCTIMER_PERF`, the kernel is also
+ * bracketed by a CTimer counter set over all threads, and `instr_print()`
+ * adds a `Counters(kernel) = ...` line with the counts, the IPC and the
+ * misses per element of the `n` elements the kernel processed (see
+ * `ctimer_perf_print()`).  The counted events come from the
+ * `CTIMER_PERF_EVENTS` environment variable.
+ *
+ * Instrumentation utilities:
+ * - `instr_t`                      :: type of kernel measurement struct
+ * - `instr_start()`                :: start timing and work/span measurement
+ * - `instr_stop()`                 :: stop both and store the results
+ * - `instr_sec()`                  :: measured time in sec
+ * - `instr_parallelism()`          :: work / span (0 without Cilkscale)
+ * - `instr_burdened_parallelism()` :: work / burdened span (0 without
+ *                                     Cilkscale)
+ * - `instr_print()`                :: print time, parallelism and counters
+ *
+ * @note Cilkscale measurements cover the whole computation between
+ * `instr_start()` and `instr_stop()`, so both must be called from the same
+ * strand, outside any spawned task whose work is being measured.
+ */
+
+
+#ifndef __H_INSTR__
+#define __H_INSTR__
+
+
+#include <stdio.h>
+
+#ifdef __cilkscale__
+#include <cilk/cilkscale.h>
+#endif
+
+#include "ctimer.h"
+
+#if defined(CTIMER_PERF) && defined(__cilk)
+#include <cilk/cilk.h>
+#endif
+
+
+/**
+ * @defgroup instr Instr
+ *
+ * Kernel time and work/span instrumentation.
+ *
+ * @{
+ */
+
+
+/* prevent C++ compilers from mangling function names */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Measurement of one kernel run.
+ */
+typedef struct {
+    ctimer_t timer;             /**< Wall-clock stopwatch */
+#ifdef __cilkscale__
+    wsp_t    start;             /**< Work/span at `instr_start()` */
+    wsp_t    wsp;               /**< Work/span between start & stop */
+#endif
+#ifdef CTIMER_PERF
+    ctimer_perf_t perf;         /**< Counters between start & stop */
+#endif
+} instr_t;
+
+
+#if defined(CTIMER_PERF) && defined(__cilk)
+/* empty task for _instr_start_workers() */
+static inline
+void _instr_nop(void) {
+}
+
+/* make the Cilk runtime start its workers, which it does lazily, so that
+ * ctimer_perf_start() finds their threads */
+static inline
+void _instr_start_workers(void) {
+    cilk_spawn _instr_nop();
+    cilk_sync;
+}
+#endif
+
+
+/**
+ * Start the stopwatch and the work/span measurement of `k`.
+ *
+ * @sa instr_stop
+ */
+static inline
+void instr_start(
+    instr_t * k                 /**<[out] kernel measurement pointer */
+) {
+#ifdef CTIMER_PERF
+#ifdef __cilk
+    _instr_start_workers();
+#endif
+    ctimer_perf_init(&k->perf, NULL);
+    ctimer_perf_start(&k->perf);
+#endif
+    ctimer_start(&k->timer);
+#ifdef __cilkscale__
+    k->start = wsp_getworkspan();
+#endif
+}
+
+
+/**
+ * Stop the work/span measurement and the stopwatch of `k`, and store the
+ * elapsed time and the work/span in between.
+ *
+ * @sa instr_start
+ */
+static inline
+void instr_stop(
+    instr_t * k                 /**<[in,out] kernel measurement pointer */
+) {
+#ifdef __cilkscale__
+    k->wsp = wsp_sub(wsp_getworkspan(), k->start);
+#endif
+    ctimer_stop(&k->timer);
+    ctimer_measure(&k->timer);
+#ifdef CTIMER_PERF
+    ctimer_perf_stop(&k->perf);
+#endif
+}
+
+
+/**
+ * Return the measured time of `k` in sec.
+ */
+static inline
+double instr_sec(
+    instr_t const k             /**<[in] kernel measurement */
+) {
+    return timespec_sec(k.timer.elapsed);
+}
+
+
+/**
+ * Return the parallelism (work / span) of `k`, or 0 without Cilkscale.
+ */
+static inline
+double instr_parallelism(
+    instr_t const k             /**<[in] kernel measurement */
+) {
+#ifdef __cilkscale__
+    return k.wsp.span > 0 ? (double)k.wsp.work / (double)k.wsp.span : 0.0;
+#else
+    (void)k;
+    return 0.0;
+#endif
+}
+
+
+/**
+ * Return the burdened parallelism (work / burdened span) of `k`, or 0 without
+ * Cilkscale.
+ */
+static inline
+double instr_burdened_parallelism(
+    instr_t const k             /**<[in] kernel measurement */
+) {
+#ifdef __cilkscale__
+    return k.wsp.bspan > 0 ? (double)k.wsp.work / (double)k.wsp.bspan : 0.0;
+#else
+    (void)k;
+    return 0.0;
+#endif
+}
+
+
+/**
+ * Print the measured time of `k` with `ctimer_print()`.  With Cilkscale,
+ * also print
+ *
+ * ```
+ * Parallelism(<label>) = <work/span>, burdened <work/burdened span>
+ * ```
+ *
+ * and dump the work/span measurement with `wsp_dump()`.  With
+ * `CTIMER_PERF`, also print the counters with `ctimer_perf_print()`, with
+ * misses per element if `elements` > 0.
+ *
+ * @sa ctimer_print
+ */
+static inline
+void instr_print(
+    instr_t const   k,          /**<[in] kernel measurement */
+    char    const * label,      /**<[in] label/description for printed time */
+    double  const   elements    /**<[in] elements processed, or 0 */
+) {
+    ctimer_print(k.timer, label);
+#ifdef __cilkscale__
+    printf("Parallelism(%s) = %.2f, burdened %.2f\n", label,
+           instr_parallelism(k), instr_burdened_parallelism(k));
+    wsp_dump(k.wsp, label);
+#endif
+#ifdef CTIMER_PERF
+    ctimer_perf_print(&k.perf, label, elements);
+#else
+    (void)elements;
+#endif
+}
+
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
+
+
+/** @} */ /* end group instr */
+
+
+#endif  /* __H_INSTR__ */
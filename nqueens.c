@@ -1,11 +1,14 @@
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 
-#include "ctimer.h"
+#include "instr.h"
 
 unsigned long long todval (struct timeval *tp) {
     return tp->tv_sec * 1000 * 1000 + tp->tv_usec;
@@ -24,7 +27,32 @@ unsigned long long todval (struct timeval *tp) {
  * nqueen 13 = 73712 
  * nqueen 14 = 365596 
  * nqueen 15 = 2279184 
+ * nqueen 16 = 14772512
+ * nqueen 17 = 95815104
+ * nqueen 18 = 666090624
+ * nqueen 19 = 4968057848
+ * nqueen 20 = 39029188884
+ * nqueen 21 = 314666222712
  */
+static const long long solutions[] = {
+  1, 1, 0, 0, 2, 10, 4, 40, 92, 352, 724, 2680, 14200, 73712, 365596,
+  2279184, 14772512, 95815104, 666090624, 4968057848LL, 39029188884LL,
+  314666222712LL
+};
+
+#define MAX_KNOWN_N ((int) (sizeof(solutions) / sizeof(solutions[0])) - 1)
+
+/*
+ * Rows at and below this depth are searched serially.  The default
+ * spawns all the way down to the leaves.
+ */
+static int spawn_depth = INT_MAX;
+
+/*
+ * With automatic cutoff selection, the spawn depth is the shallowest one
+ * with at least this many subtrees per worker.
+ */
+#define AUTO_CUTOFF_SLACK 32
 
 /*
  * <a> contains array of <n> queen positions.  Returns 1
@@ -47,18 +75,45 @@ int ok (int n, char *a) {
   return 1;
 }
 
-int nqueens (int n, int j, char *a) {
+/*
+ * Serial solver for the rows at and below <j>: backtracks on the board
+ * <a> in place, which must have room for <n> queens.
+ */
+long long nqueens_serial (int n, int j, char *a) {
+
+  long long solNum = 0;
+
+  if (n == j) {
+    return 1;
+  }
+
+  for (int i = 0; i < n; i++) {
+    a[j] = i;
+    if (ok(j + 1, a))
+      solNum += nqueens_serial(n, j + 1, a);
+  }
+
+  return solNum;
+}
+
+long long nqueens (int n, int j, char *a) {
 
   char *b;
-  int *count;
-  int solNum = 0;
+  long long *count;
+  long long solNum = 0;
 
   if (n == j) {
     return 1;
   }
 
-  count = (int *) alloca(n * sizeof(int));
-  (void) memset(count, 0, n * sizeof (int));
+  if (j >= spawn_depth) {
+    char board[128];
+    memcpy(board, a, j * sizeof (char));
+    return nqueens_serial(n, j, board);
+  }
+
+  count = (long long *) alloca(n * sizeof(long long));
+  (void) memset(count, 0, n * sizeof (long long));
 
   b = (char *) alloca((j + 1) * sizeof (char));
   memcpy(b, a, j * sizeof (char));
@@ -78,38 +133,522 @@ int nqueens (int n, int j, char *a) {
   return solNum;
 }
 
+/* Largest board the fixed-size engines support. */
+#define NQUEENS_MAX_N 32
+
+/* Queen positions of the first rows of a board, passed by value. */
+typedef struct {
+  char q[NQUEENS_MAX_N];
+} board_t;
+
+void zero_count (void *view) {
+  *(long long *) view = 0;
+}
+
+void add_count (void *left, void *right) {
+  *(long long *) left += *(long long *) right;
+}
+
+/*
+ * Same search as nqueens(), without per-node allocation: the board is
+ * passed by value in a fixed-size struct, and solutions are counted in
+ * the opadd reducer <*sum> instead of a per-node count array.
+ */
+void nqueens_reducer (int n, int j, board_t b,
+                      long long cilk_reducer(zero_count, add_count) *sum) {
+
+  if (n == j) {
+    *sum += 1;
+    return;
+  }
+
+  if (j >= spawn_depth) {
+    *sum += nqueens_serial(n, j, b.q);
+    return;
+  }
+
+  cilk_scope {
+    for (int i = 0; i < n; i++) {
+      b.q[j] = i;
+      if (ok(j + 1, b.q))
+        cilk_spawn nqueens_reducer(n, j + 1, b, sum);
+    }
+  }
+}
+
+/*
+ * Bitmask engine.  The queens placed so far are summarized by three
+ * bitmasks over the columns of the next row: <cols> has the columns
+ * already taken, and <ld> and <rd> the squares attacked along the two
+ * diagonals.  <all> has the low n bits set.  Each node then finds its
+ * free squares with one expression, instead of rechecking every pair of
+ * queens as ok() does.  Returns the number of ways to complete the board.
+ */
+long long nqueens_bits_serial (unsigned all, unsigned cols, unsigned ld,
+                               unsigned rd) {
+
+  long long solNum = 0;
+
+  if (cols == all) {
+    return 1;
+  }
+
+  unsigned poss = ~(cols | ld | rd) & all;
+  while (poss) {
+    unsigned bit = poss & -poss;
+    poss ^= bit;
+    solNum += nqueens_bits_serial(all, cols | bit, ((ld | bit) << 1) & all,
+                                  (rd | bit) >> 1);
+  }
+
+  return solNum;
+}
+
+long long nqueens_bits (unsigned all, unsigned cols, unsigned ld,
+                        unsigned rd) {
+
+  long long count[NQUEENS_MAX_N];
+  int k = 0;
+  long long solNum = 0;
+
+  if (cols == all) {
+    return 1;
+  }
+
+  /* the depth is the number of queens placed */
+  if (__builtin_popcount(cols) >= spawn_depth) {
+    return nqueens_bits_serial(all, cols, ld, rd);
+  }
+
+  unsigned poss = ~(cols | ld | rd) & all;
+
+  cilk_scope {
+    while (poss) {
+      unsigned bit = poss & -poss;
+      poss ^= bit;
+      count[k++] = cilk_spawn nqueens_bits(all, cols | bit,
+                                           ((ld | bit) << 1) & all,
+                                           (rd | bit) >> 1);
+    }
+  }
+
+  for (int i = 0; i < k; i++) {
+    solNum += count[i];
+  }
+
+  return solNum;
+}
+
+/*
+ * Solution writer.  Each worker formats the solutions it finds into its
+ * own buffer, indexed by worker number, and hands the buffer to the
+ * stream in one fwrite() when it fills up; the search never waits on
+ * another worker except for the stream lock at those batch boundaries.
+ * Solutions therefore come out in no particular order.  The text format
+ * has one line per solution with the column of the queen in each row;
+ * the binary format has <n> bytes per solution, one column per row.
+ */
+#define SOLUTION_BATCH 8192
+
+typedef struct {
+  size_t len;
+  char buf[SOLUTION_BATCH];
+} __attribute__((aligned(64))) solution_buffer_t;
+
+static solution_buffer_t *solution_buffers;
+static FILE *solution_file;
+static int solution_binary;
+
+/* Also write the mirror image of each solution, for symmetric searches. */
+static int solution_mirrors;
+
+void flush_solutions (solution_buffer_t *sb) {
+  if (sb->len > 0) {
+    fwrite(sb->buf, 1, sb->len, solution_file);
+    sb->len = 0;
+  }
+}
+
+void write_solution (int n, const char *q, int mirror) {
+
+  solution_buffer_t *sb = &solution_buffers[__cilkrts_get_worker_number()];
+
+  /* at most three digits and a separator per queen */
+  if (sb->len + 4 * n > SOLUTION_BATCH) {
+    flush_solutions(sb);
+  }
+
+  char *p = sb->buf + sb->len;
+  for (int i = 0; i < n; i++) {
+    int c = mirror ? n - 1 - q[i] : q[i];
+    if (solution_binary) {
+      *p++ = c;
+    } else {
+      p += sprintf(p, (i + 1 < n) ? "%d " : "%d\n", c);
+    }
+  }
+  sb->len = p - sb->buf;
+}
+
+void emit_solution (int n, const char *q) {
+  if (solution_file) {
+    write_solution(n, q, 0);
+    if (solution_mirrors)
+      write_solution(n, q, 1);
+  }
+}
+
+/*
+ * Enumerating engine: the bitmask search, also carrying the queen
+ * positions in <b> so that every solution can be passed to
+ * emit_solution().  <j> is the number of queens placed.
+ */
+long long nqueens_enum_serial (int n, int j, board_t *b, unsigned all,
+                               unsigned cols, unsigned ld, unsigned rd) {
+
+  long long solNum = 0;
+
+  if (cols == all) {
+    emit_solution(n, b->q);
+    return 1;
+  }
+
+  unsigned poss = ~(cols | ld | rd) & all;
+  while (poss) {
+    unsigned bit = poss & -poss;
+    poss ^= bit;
+    b->q[j] = __builtin_ctz(bit);
+    solNum += nqueens_enum_serial(n, j + 1, b, all, cols | bit,
+                                  ((ld | bit) << 1) & all, (rd | bit) >> 1);
+  }
+
+  return solNum;
+}
+
+long long nqueens_enum (int n, int j, board_t b, unsigned all,
+                        unsigned cols, unsigned ld, unsigned rd) {
+
+  long long count[NQUEENS_MAX_N];
+  int k = 0;
+  long long solNum = 0;
+
+  if (cols == all) {
+    emit_solution(n, b.q);
+    return 1;
+  }
+
+  if (j >= spawn_depth) {
+    return nqueens_enum_serial(n, j, &b, all, cols, ld, rd);
+  }
+
+  unsigned poss = ~(cols | ld | rd) & all;
+
+  cilk_scope {
+    while (poss) {
+      unsigned bit = poss & -poss;
+      poss ^= bit;
+      b.q[j] = __builtin_ctz(bit);
+      count[k++] = cilk_spawn nqueens_enum(n, j + 1, b, all, cols | bit,
+                                           ((ld | bit) << 1) & all,
+                                           (rd | bit) >> 1);
+    }
+  }
+
+  for (int i = 0; i < k; i++) {
+    solNum += count[i];
+  }
+
+  return solNum;
+}
+
+/*
+ * Return the number of partial boards with <depth> more queens placed,
+ * given the bitmasks of nqueens_bits().
+ */
+long count_subtrees (unsigned all, unsigned cols, unsigned ld, unsigned rd,
+                     int depth) {
+
+  long count = 0;
+
+  if (depth == 0 || cols == all) {
+    return 1;
+  }
+
+  unsigned poss = ~(cols | ld | rd) & all;
+  while (poss) {
+    unsigned bit = poss & -poss;
+    poss ^= bit;
+    count += count_subtrees(all, cols | bit, ((ld | bit) << 1) & all,
+                            (rd | bit) >> 1, depth - 1);
+  }
+
+  return count;
+}
+
+/*
+ * Pick a spawn depth for an <n>-queens search on the current workers:
+ * the shallowest one that leaves AUTO_CUTOFF_SLACK subtrees per worker
+ * for the serial solvers.
+ */
+int auto_spawn_depth (int n) {
+
+  long target = (long) AUTO_CUTOFF_SLACK * __cilkrts_get_nworkers();
+  unsigned all = (n == NQUEENS_MAX_N) ? ~0u : (1u << n) - 1;
+
+  for (int d = 1; d < n; d++) {
+    if (count_subtrees(all, 0, 0, 0, d) >= target)
+      return d;
+  }
+  return n;
+}
+
+/* Engines the driver can run. */
+enum engine {
+  ENGINE_ARRAY,    /* nqueens(): board array checked with ok() */
+  ENGINE_REDUCER,  /* nqueens_reducer() */
+  ENGINE_BITMASK,  /* nqueens_bits() */
+  ENGINE_ENUM,     /* nqueens_enum(): also writes out the solutions */
+  NUM_ENGINES
+};
+
+static const char *const engine_names[] = {"array", "reducer", "bitmask",
+                                           "enum"};
+
+/*
+ * Count the ways to complete the partial board <b>, with queens in its
+ * first <j> rows, using engine <e>.
+ */
+long long run_engine (enum engine e, int n, int j, board_t b) {
+
+  if (e == ENGINE_BITMASK || e == ENGINE_ENUM) {
+    unsigned all = (n == NQUEENS_MAX_N) ? ~0u : (1u << n) - 1;
+    unsigned cols = 0, ld = 0, rd = 0;
+    for (int i = 0; i < j; i++) {
+      int c = b.q[i], d = j - i;
+      cols |= 1u << c;
+      if (c + d < n)
+        ld |= 1u << (c + d);
+      if (c - d >= 0)
+        rd |= 1u << (c - d);
+    }
+    if (e == ENGINE_ENUM)
+      return nqueens_enum(n, j, b, all, cols, ld, rd);
+    return nqueens_bits(all, cols, ld, rd);
+  } else if (e == ENGINE_REDUCER) {
+    long long cilk_reducer(zero_count, add_count) count = 0;
+    nqueens_reducer(n, j, b, &count);
+    return count;
+  } else {
+    return nqueens(n, j, b.q);
+  }
+}
+
+/*
+ * Count the solutions of the <n>-queens problem with engine <e>, using
+ * the left-right reflection of the board: every solution with the first
+ * queen in the left half mirrors one with it in the right half, so only
+ * the left half is searched and the count doubled.  For odd <n>, the
+ * solutions with the first queen in the middle column are split the same
+ * way by the column of the second queen.
+ */
+long long nqueens_symmetric (enum engine e, int n) {
+
+  long long count[NQUEENS_MAX_N];
+  int k = 0;
+  long long solNum = 0;
+
+  if (n == 1) {
+    board_t b = {{0}};
+    return run_engine(e, n, 0, b);
+  }
+
+  cilk_scope {
+    for (int i = 0; i < n / 2; i++) {
+      board_t b = {{0}};
+      b.q[0] = i;
+      count[k++] = cilk_spawn run_engine(e, n, 1, b);
+    }
+    if (n % 2) {
+      int m = n / 2;
+      for (int i = 0; i < m - 1; i++) {
+        board_t b = {{0}};
+        b.q[0] = m;
+        b.q[1] = i;
+        count[k++] = cilk_spawn run_engine(e, n, 2, b);
+      }
+    }
+  }
+
+  for (int i = 0; i < k; i++) {
+    solNum += count[i];
+  }
+
+  return 2 * solNum;
+}
+
+void usage (const char *prog) {
+  fprintf (stderr, "Usage: %s [<options>] <n>\n", prog);
+  fprintf (stderr, "  -e, --engine <e>  array, reducer, bitmask, enum "
+                   "(default array)\n");
+  fprintf (stderr, "  -c, --cutoff <d>  search rows >= <d> serially, or pick "
+                   "<d> for the\n"
+                   "                    workers with 'auto' (default: spawn "
+                   "at every row)\n");
+  fprintf (stderr, "  -s, --symmetry    search half the board and double "
+                   "the count\n");
+  fprintf (stderr, "  -o, --output <f>  write every solution to <f> "
+                   "('-' for stdout);\n"
+                   "                    implies the enum engine\n");
+  fprintf (stderr, "  -b, --binary      write <n> bytes per solution "
+                   "instead of text\n");
+}
+
 
 int main(int argc, char *argv[]) { 
 
   int n = 13;
-  char *a;
-  int res;
+  long long res;
+  enum engine engine = ENGINE_ARRAY;
 
-  if (argc < 2) {
-    fprintf (stderr, "Usage: %s [<cilk-options>] <n>\n", argv[0]);
+  static const struct option longopts[] = {
+    {"engine", required_argument, NULL, 'e'},
+    {"cutoff", required_argument, NULL, 'c'},
+    {"symmetry", no_argument,     NULL, 's'},
+    {"output", required_argument, NULL, 'o'},
+    {"binary", no_argument,       NULL, 'b'},
+    {"help",   no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  int autoCutoff = 0;
+  int symmetry = 0;
+  const char *output = NULL;
+  int opt;
+  while ((opt = getopt_long (argc, argv, "e:c:so:bh", longopts, NULL)) != -1) {
+    switch (opt) {
+    case 'e':
+      engine = NUM_ENGINES;
+      for (int i = 0; i < NUM_ENGINES; i++) {
+        if (strcmp (optarg, engine_names[i]) == 0)
+          engine = (enum engine) i;
+      }
+      if (engine == NUM_ENGINES) {
+        usage (argv[0]);
+        return 1;
+      }
+      break;
+    case 'c':
+      if (strcmp (optarg, "auto") == 0) {
+        autoCutoff = 1;
+      } else {
+        spawn_depth = atoi (optarg);
+      }
+      break;
+    case 's':
+      symmetry = 1;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'b':
+      solution_binary = 1;
+      break;
+    case 'h':
+      usage (argv[0]);
+      return 0;
+    default:
+      usage (argv[0]);
+      return 1;
+    }
+  }
+
+  /* only the enum engine writes out solutions, whatever -e came with -o */
+  if (output) {
+    engine = ENGINE_ENUM;
+  }
+
+  if (optind >= argc) {
+    usage (argv[0]);
     fprintf (stderr, "Use default board size, n = 13.\n");
 
   } else {
-    n = atoi (argv[1]);
-    fprintf (stderr, "Running %s with n = %d.\n", argv[0], n);
+    n = atoi (argv[optind]);
+    fprintf (stderr, "Running %s with n = %d (%s engine).\n", argv[0], n,
+             engine_names[engine]);
+  }
+
+  int max_n = (engine == ENGINE_ARRAY && !symmetry) ? 127 : NQUEENS_MAX_N;
+  if (n < 1 || n > max_n) {
+    fprintf (stderr, "Board size must be between 1 and %d.\n", max_n);
+    return 1;
+  }
+
+  if (autoCutoff) {
+    spawn_depth = auto_spawn_depth(n);
+  }
+  if (spawn_depth <= 0) {
+    fprintf (stderr, "Searching serially.\n");
+  } else if (spawn_depth < n) {
+    fprintf (stderr, "Spawning in rows 0..%d, serial below.\n",
+             spawn_depth - 1);
+  }
+
+  if (output) {
+    solution_file = (strcmp (output, "-") == 0) ? stdout
+                                                : fopen (output, "wb");
+    if (!solution_file) {
+      perror (output);
+      return 1;
+    }
+    solution_buffers = calloc (__cilkrts_get_nworkers(),
+                               sizeof (solution_buffer_t));
+    if (!solution_buffers) {
+      fprintf (stderr, "solution buffer allocation failed\n");
+      return 1;
+    }
+    /* the one-queen board is its own mirror image */
+    solution_mirrors = symmetry && n > 1;
   }
 
-  a = (char *) alloca (n * sizeof (char));
   res = 0;
 
-  ctimer_t t;
-  ctimer_start(&t);
+  instr_t k;
+  instr_start(&k);
+
+  if (symmetry) {
+    res = nqueens_symmetric(engine, n);
+  } else {
+    board_t b = {{0}};
+    res = run_engine(engine, n, 0, b);
+  }
+
+  if (solution_file) {
+    for (unsigned w = 0; w < __cilkrts_get_nworkers(); w++) {
+      flush_solutions(&solution_buffers[w]);
+    }
+  }
 
-  res = nqueens(n, 0, a);
+  instr_stop(&k);
+  instr_print(k, "nqueens", res);
 
-  ctimer_stop(&t);
-  ctimer_measure(&t);
-  ctimer_print(t, "nqueens");
+  if (solution_file) {
+    /* a short fwrite() in flush_solutions() leaves the error indicator set */
+    int failed = ferror (solution_file);
+    if (fclose (solution_file) != 0 || failed) {
+      perror (output);
+      return 1;
+    }
+    free (solution_buffers);
+  }
 
   if (res == 0) {
     fprintf (stderr, "No solution found.\n");
   } else {
-    fprintf (stderr, "Total number of solutions : %d\n", res);
+    fprintf (stderr, "Total number of solutions : %lld\n", res);
+  }
+
+  if (n <= MAX_KNOWN_N && res != solutions[n]) {
+    fprintf (stderr, "Expected %lld solutions.\n", solutions[n]);
+    return 1;
   }
 
   return 0;
@@ -0,0 +1,410 @@
+/* -*- c -*- */
+
+/**
+ * [Include-only header library]
+ * Parallel building blocks for Cilk: reductions, prefix sums and per-worker
+ * histograms.
+ *
+ * @file        pprim.h
+ * @version     1.0.0
+ * @license     MIT
+ */
+
+
+/**
+ * @mainpage
+ *
+ * @section overview Overview
+ *
+ * PPrim is an include-only header library with the parallel primitives that
+ * the tutorial kernels share:
+ *
+ * - `PPRIM_DEFINE()`          :: macro that generates a sum reduction and
+ *   exclusive/inclusive prefix sums over arrays of one element type
+ * - `pprim_reduce_blocks()`   :: sum of a callback over the blocks of an
+ *   index range, e.g. to count the elements with some property
+ * - `pprim_hist_t`            :: histogram with one cache-line-padded row of
+ *   counters per Cilk worker
+ *
+ * Specializations for common element types are predefined:
+ * - `pprim_ptrdiff_*()` :: `ptrdiff_t`
+ * - `pprim_i64_*()`     :: `int64_t`
+ * - `pprim_u64_*()`     :: `uint64_t`
+ * - `pprim_double_*()`  :: `double`
+ *
+ * @section algorithm Algorithms
+ *
+ * Reductions split their range in halves with `cilk_spawn` down to
+ * `PPRIM_GRAINSIZE` elements, so they take O(n) work and O(log n) span, and
+ * add up the same blocks in the same order on any number of workers.
+ *
+ * Prefix sums are work-efficient and blocked: a `cilk_for` sums each block
+ * of `PPRIM_GRAINSIZE` elements, the block sums are scanned (recursively),
+ * and a second `cilk_for` scans each block from its offset.  That is O(n)
+ * work and reads the array twice; on one worker, or below
+ * `PPRIM_SCAN_CUTOFF` elements, the serial single-pass loop runs instead.
+ * Floating-point results may therefore differ in rounding between worker
+ * counts.
+ *
+ * A `pprim_hist_t` gives every worker its own row of counters, padded to
+ * whole cache lines, so workers count without atomics or false sharing; the
+ * rows are added up once at the end.
+ *
+ * @section usage Using PPrim
+ *
+ * @code
+ * ptrdiff_t total = pprim_ptrdiff_exclusive_scan(offsets, nblocks);
+ *
+ * pprim_hist_t h;
+ * pprim_hist_init(&h, 256);
+ * cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+ *     uint64_t * row = pprim_hist_row(&h);
+ *     for (ptrdiff_t i = b * B; i < (b + 1) * B; ++i)
+ *         row[key[i] & 255]++;
+ * }
+ * pprim_hist_total(&h, counts);
+ * pprim_hist_free(&h);
+ * @endcode
+ */
+
+
+#ifndef __H_PPRIM__
+#define __H_PPRIM__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+
+/**
+ * @defgroup pprim PPrim
+ *
+ * Parallel reductions, prefix sums and histograms.
+ *
+ * @{
+ */
+
+
+/* ==================================================
+ * CONSTANTS
+ * ================================================== */
+
+
+/** Elements per serial block of the reductions and prefix sums. */
+#ifndef PPRIM_GRAINSIZE
+#define PPRIM_GRAINSIZE 4096
+#endif
+
+/** Prefix sums shorter than this run serially. */
+#ifndef PPRIM_SCAN_CUTOFF
+#define PPRIM_SCAN_CUTOFF (4 * PPRIM_GRAINSIZE)
+#endif
+
+/** Cache line size in bytes, which `pprim_hist_t` rows are padded to. */
+#ifndef PPRIM_CACHE_LINE
+#define PPRIM_CACHE_LINE 64
+#endif
+
+
+/* prevent C++ compilers from mangling function names */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ==================================================
+ * TYPE-SPECIALIZED REDUCTIONS AND PREFIX SUMS
+ * ================================================== */
+
+
+/**
+ * @defgroup pprim_typed Type-specialized reductions and prefix sums
+ *
+ * Macros that generate reductions and prefix sums for one element type.
+ *
+ * @{
+ */
+
+
+/**
+ * Define a parallel sum and parallel prefix sums of arrays of the arithmetic
+ * type `type`:
+ *
+ * ```
+ * type <name>_sum(type const * a, ptrdiff_t n);
+ * type <name>_exclusive_scan(type * a, ptrdiff_t n);
+ * type <name>_inclusive_scan(type * a, ptrdiff_t n);
+ * ```
+ *
+ * `<name>_sum()` returns `a[0] + ... + a[n-1]`.  The scans replace `a[i]` in
+ * place with the sum of `a[0..i)` (exclusive) or `a[0..i]` (inclusive) and
+ * return the sum of all `n` elements.  If the scratch array of block sums
+ * cannot be allocated, the scans run serially.  The generated helper
+ * functions are `static inline` and prefixed with `<name>_`.
+ */
+#define PPRIM_DEFINE(name, type)                                              \
+                                                                              \
+static inline                                                                 \
+type name##_sum_serial(type const * a, ptrdiff_t n) {                         \
+    type s = 0;                                                               \
+    for (ptrdiff_t i = 0; i < n; i++)                                         \
+        s += a[i];                                                            \
+    return s;                                                                 \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+type name##_sum(type const * a, ptrdiff_t n) {                                \
+    if (n <= PPRIM_GRAINSIZE)                                                 \
+        return name##_sum_serial(a, n);                                       \
+    ptrdiff_t half = n / 2;                                                   \
+    type x, y;                                                                \
+    x = cilk_spawn name##_sum(a, half);                                       \
+    y = name##_sum(a + half, n - half);                                       \
+    cilk_sync;                                                                \
+    return x + y;                                                             \
+}                                                                             \
+                                                                              \
+/* scan a[0..n) in place, starting from s; return s + the sum of a */        \
+static inline                                                                 \
+type name##_scan_serial(type * a, ptrdiff_t n, type s, int inclusive) {       \
+    if (inclusive) {                                                          \
+        for (ptrdiff_t i = 0; i < n; i++)                                     \
+            a[i] = s += a[i];                                                 \
+    } else {                                                                  \
+        for (ptrdiff_t i = 0; i < n; i++) {                                   \
+            type x = a[i];                                                    \
+            a[i] = s;                                                         \
+            s += x;                                                           \
+        }                                                                     \
+    }                                                                         \
+    return s;                                                                 \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+type name##_scan(type * a, ptrdiff_t n, int inclusive) {                      \
+    if (n < PPRIM_SCAN_CUTOFF || __cilkrts_get_nworkers() == 1)               \
+        return name##_scan_serial(a, n, 0, inclusive);                        \
+    ptrdiff_t nblocks = (n + PPRIM_GRAINSIZE - 1) / PPRIM_GRAINSIZE;          \
+    type * sums = (type *)malloc(sizeof(type) * nblocks);                     \
+    if (sums == NULL)                                                         \
+        return name##_scan_serial(a, n, 0, inclusive);                        \
+    cilk_for (ptrdiff_t b = 0; b < nblocks; b++) {                            \
+        ptrdiff_t lo = b * PPRIM_GRAINSIZE;                                   \
+        ptrdiff_t hi = (b == nblocks - 1) ? n : lo + PPRIM_GRAINSIZE;         \
+        sums[b] = name##_sum_serial(a + lo, hi - lo);                         \
+    }                                                                         \
+    type total = name##_scan(sums, nblocks, 0);                               \
+    cilk_for (ptrdiff_t b = 0; b < nblocks; b++) {                            \
+        ptrdiff_t lo = b * PPRIM_GRAINSIZE;                                   \
+        ptrdiff_t hi = (b == nblocks - 1) ? n : lo + PPRIM_GRAINSIZE;         \
+        name##_scan_serial(a + lo, hi - lo, sums[b], inclusive);              \
+    }                                                                         \
+    free(sums);                                                               \
+    return total;                                                             \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+type name##_exclusive_scan(type * a, ptrdiff_t n) {                           \
+    return name##_scan(a, n, 0);                                              \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+type name##_inclusive_scan(type * a, ptrdiff_t n) {                           \
+    return name##_scan(a, n, 1);                                              \
+}
+
+
+PPRIM_DEFINE(pprim_ptrdiff, ptrdiff_t)
+PPRIM_DEFINE(pprim_i64,     int64_t)
+PPRIM_DEFINE(pprim_u64,     uint64_t)
+PPRIM_DEFINE(pprim_double,  double)
+
+
+/** @} */ /* end group pprim_typed */
+
+
+/* ==================================================
+ * BLOCK REDUCTION
+ * ================================================== */
+
+
+/**
+ * @defgroup pprim_blocks Block reduction
+ *
+ * Sum of a callback over the blocks of an index range.  The callback runs a
+ * serial loop over its block, so the indirect call is paid once per block.
+ *
+ * @{
+ */
+
+
+/**
+ * Block callback type of `pprim_reduce_blocks()`: returns the contribution of
+ * the indices `[lo, hi)`.
+ */
+typedef int64_t (*pprim_block_fn)(ptrdiff_t lo, ptrdiff_t hi, void * ctx);
+
+
+/* sum of block() over the blocks of [lo, hi), which starts at a block
+ * boundary */
+static inline
+int64_t _pprim_reduce_range(
+    ptrdiff_t              lo,
+    ptrdiff_t              hi,
+    ptrdiff_t              grain,
+    pprim_block_fn const   block,
+    void                 * ctx
+) {
+    if (hi - lo <= grain)
+        return block(lo, hi, ctx);
+    /* split between whole blocks */
+    ptrdiff_t mid = lo + (hi - lo + grain - 1) / grain / 2 * grain;
+    int64_t x, y;
+    x = cilk_spawn _pprim_reduce_range(lo, mid, grain, block, ctx);
+    y = _pprim_reduce_range(mid, hi, grain, block, ctx);
+    cilk_sync;
+    return x + y;
+}
+
+
+/**
+ * Return the sum of `block(lo, hi, ctx)` over blocks `[lo, hi)` that cover
+ * `[0, n)`, of `grain` indices each (the last one may be shorter), evaluated
+ * in parallel.  The blocks are the same for any number of workers.
+ */
+static inline
+int64_t pprim_reduce_blocks(
+    ptrdiff_t              n,     /**<[in] number of indices */
+    ptrdiff_t              grain, /**<[in] block size (> 0) */
+    pprim_block_fn const   block, /**<[in] block callback */
+    void                 * ctx    /**<[in] callback context */
+) {
+    return (n > 0) ? _pprim_reduce_range(0, n, grain, block, ctx) : 0;
+}
+
+
+/** @} */ /* end group pprim_blocks */
+
+
+/* ==================================================
+ * PER-WORKER HISTOGRAM
+ * ================================================== */
+
+
+/**
+ * @defgroup pprim_hist Per-worker histogram
+ *
+ * Histogram with a private row of counters per Cilk worker.
+ *
+ * @{
+ */
+
+
+/**
+ * Histogram of `nbins` bins with one row of counters per worker.
+ */
+typedef struct {
+    uint64_t * counts;          /**< `nrows` rows of `stride` counters */
+    size_t     nbins;           /**< Number of bins */
+    size_t     stride;          /**< Counters per row, whole cache lines */
+    unsigned   nrows;           /**< Number of rows (workers) */
+} pprim_hist_t;
+
+
+/**
+ * Allocate a zeroed histogram of `nbins` bins for the current workers.
+ *
+ * @return 0 on success, -1 if the counters cannot be allocated
+ */
+static inline
+int pprim_hist_init(
+    pprim_hist_t * h,           /**<[out] histogram pointer */
+    size_t         nbins        /**<[in]  number of bins */
+) {
+    size_t const line = PPRIM_CACHE_LINE / sizeof(uint64_t);
+    h->nbins = nbins;
+    h->stride = (nbins + line - 1) / line * line;
+    h->nrows = __cilkrts_get_nworkers();
+    size_t bytes = sizeof(uint64_t) * h->stride * h->nrows;
+    h->counts = (uint64_t *)aligned_alloc(PPRIM_CACHE_LINE,
+                                          bytes ? bytes : PPRIM_CACHE_LINE);
+    if (h->counts == NULL)
+        return -1;
+    memset(h->counts, 0, bytes);
+    return 0;
+}
+
+
+/**
+ * Zero all the counters of a histogram.
+ */
+static inline
+void pprim_hist_reset(
+    pprim_hist_t * h            /**<[in,out] histogram pointer */
+) {
+    memset(h->counts, 0, sizeof(uint64_t) * h->stride * h->nrows);
+}
+
+
+/**
+ * Return the row of counters of the calling worker: `row[bin]++` counts an
+ * element in `bin`.
+ *
+ * @warning The row belongs to the worker, not the task.  Fetch it again
+ * after every `cilk_spawn` and `cilk_sync` (and in every `cilk_for`
+ * iteration), since the task may continue on another worker.
+ */
+static inline
+uint64_t * pprim_hist_row(
+    pprim_hist_t const * h      /**<[in] histogram pointer */
+) {
+    return h->counts + (size_t)__cilkrts_get_worker_number() * h->stride;
+}
+
+
+/**
+ * Add up the rows of a histogram into `total[0..nbins)`.
+ */
+static inline
+void pprim_hist_total(
+    pprim_hist_t const * h,     /**<[in]  histogram pointer */
+    uint64_t           * total  /**<[out] counts per bin */
+) {
+    memcpy(total, h->counts, sizeof(uint64_t) * h->nbins);
+    for (unsigned r = 1; r < h->nrows; r++) {
+        uint64_t const * row = h->counts + (size_t)r * h->stride;
+        for (size_t b = 0; b < h->nbins; b++)
+            total[b] += row[b];
+    }
+}
+
+
+/**
+ * Free the counters of a histogram.
+ */
+static inline
+void pprim_hist_free(
+    pprim_hist_t * h            /**<[in,out] histogram pointer */
+) {
+    free(h->counts);
+    h->counts = NULL;
+}
+
+
+/** @} */ /* end group pprim_hist */
+
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
+
+
+/** @} */ /* end group pprim */
+
+
+#endif  /* __H_PPRIM__ */
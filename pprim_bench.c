@@ -0,0 +1,209 @@
+/*
+ * pprim_bench.c
+ *
+ * Microbenchmarks of the pprim.h primitives against the serial loops they
+ * replace: sum, exclusive prefix sum, 256-bin histogram and a block
+ * reduction that counts descents, on an array of 64-bit keys.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+#include "ctimer.h"
+#include "pprim.h"
+
+// Number of digit bins of the histogram benchmark.
+#define HIST_BINS 256
+
+// Elements per block of the histogram and descent benchmarks.
+#define BENCH_BLOCK 4096
+
+static inline uint64_t splitmix64(uint64_t seed, uint64_t i) {
+  uint64_t z = seed + (i + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Each kernel returns a checksum of its result, so that the serial and
+// parallel versions can be checked against each other.
+
+static uint64_t sum_serial(uint64_t* a, ptrdiff_t n) {
+  uint64_t s = 0;
+  for (ptrdiff_t i = 0; i < n; ++i) {
+    s += a[i];
+  }
+  return s;
+}
+
+static uint64_t sum_parallel(uint64_t* a, ptrdiff_t n) {
+  return pprim_u64_sum(a, n);
+}
+
+static uint64_t scan_checksum(const uint64_t* a, ptrdiff_t n, uint64_t total) {
+  return total ^ a[n / 3] ^ a[n / 2] ^ a[n - 1];
+}
+
+static uint64_t scan_serial(uint64_t* a, ptrdiff_t n) {
+  uint64_t s = 0;
+  for (ptrdiff_t i = 0; i < n; ++i) {
+    uint64_t x = a[i];
+    a[i] = s;
+    s += x;
+  }
+  return scan_checksum(a, n, s);
+}
+
+static uint64_t scan_parallel(uint64_t* a, ptrdiff_t n) {
+  uint64_t s = pprim_u64_exclusive_scan(a, n);
+  return scan_checksum(a, n, s);
+}
+
+static uint64_t hist_checksum(const uint64_t* counts) {
+  uint64_t h = 0;
+  for (int d = 0; d < HIST_BINS; ++d) {
+    h = h * 31 + counts[d];
+  }
+  return h;
+}
+
+static uint64_t hist_serial(uint64_t* a, ptrdiff_t n) {
+  uint64_t counts[HIST_BINS] = {0};
+  for (ptrdiff_t i = 0; i < n; ++i) {
+    counts[a[i] & (HIST_BINS - 1)]++;
+  }
+  return hist_checksum(counts);
+}
+
+static uint64_t hist_parallel(uint64_t* a, ptrdiff_t n) {
+  pprim_hist_t h;
+  if (pprim_hist_init(&h, HIST_BINS) != 0) {
+    printf("histogram allocation failed\n");
+    exit(-1);
+  }
+  ptrdiff_t nblocks = (n + BENCH_BLOCK - 1) / BENCH_BLOCK;
+  cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+    uint64_t* row = pprim_hist_row(&h);
+    ptrdiff_t hi = (b == nblocks - 1) ? n : (b + 1) * BENCH_BLOCK;
+    for (ptrdiff_t i = b * BENCH_BLOCK; i < hi; ++i) {
+      row[a[i] & (HIST_BINS - 1)]++;
+    }
+  }
+  uint64_t counts[HIST_BINS];
+  pprim_hist_total(&h, counts);
+  pprim_hist_free(&h);
+  return hist_checksum(counts);
+}
+
+static uint64_t descents_serial(uint64_t* a, ptrdiff_t n) {
+  uint64_t count = 0;
+  for (ptrdiff_t i = 1; i < n; ++i) {
+    count += a[i] < a[i-1];
+  }
+  return count;
+}
+
+static int64_t descents_block(ptrdiff_t lo, ptrdiff_t hi, void* ctx) {
+  const uint64_t* a = (const uint64_t *) ctx;
+  int64_t count = 0;
+  for (ptrdiff_t i = (lo == 0) ? 1 : lo; i < hi; ++i) {
+    count += a[i] < a[i-1];
+  }
+  return count;
+}
+
+static uint64_t descents_parallel(uint64_t* a, ptrdiff_t n) {
+  return pprim_reduce_blocks(n, BENCH_BLOCK, descents_block, a);
+}
+
+static const struct {
+  const char* name;
+  uint64_t (*serial)(uint64_t*, ptrdiff_t);
+  uint64_t (*parallel)(uint64_t*, ptrdiff_t);
+  bool inPlace;  // overwrites its input, which is restored before each trial
+} benches[] = {
+  {"sum",      sum_serial,      sum_parallel,      false},
+  {"scan",     scan_serial,     scan_parallel,     true},
+  {"hist",     hist_serial,     hist_parallel,     false},
+  {"descents", descents_serial, descents_parallel, false},
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+// Fastest of trials runs of kernel on a copy of src, in sec; *check gets
+// the checksum of the last run.
+static double best_time(uint64_t (*kernel)(uint64_t*, ptrdiff_t),
+                        uint64_t* a, const uint64_t* src, ptrdiff_t n,
+                        bool inPlace, int trials, uint64_t* check) {
+  double best = 0;
+  for (int t = 0; t < trials; ++t) {
+    if (inPlace || t == 0) {
+      cilk_for (ptrdiff_t i = 0; i < n; ++i) {
+        a[i] = src[i];
+      }
+    }
+    ctimer_t timer;
+    ctimer_start(&timer);
+    *check = kernel(a, n);
+    ctimer_stop(&timer);
+    ctimer_measure(&timer);
+    double sec = timespec_sec(timer.elapsed);
+    if (t == 0 || sec < best) {
+      best = sec;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  // number of keys, default 16M (128 MB), and timed trials per kernel
+  ptrdiff_t n = (ptrdiff_t) 1 << 24;
+  int trials = 5;
+  if (argc > 1) {
+    n = atol(argv[1]);
+  }
+  if (argc > 2) {
+    trials = atoi(argv[2]);
+  }
+  if (n < 1 || trials < 1) {
+    fprintf(stderr, "Usage: %s [<n> [<trials>]]\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t* src = (uint64_t *) malloc(sizeof(uint64_t) * n);
+  uint64_t* a = (uint64_t *) malloc(sizeof(uint64_t) * n);
+  if (!src || !a) {
+    printf("array allocation failed\n");
+    return 1;
+  }
+  // small keys, so that the prefix sums do not wrap
+  cilk_for (ptrdiff_t i = 0; i < n; ++i) {
+    src[i] = splitmix64(13, i) >> 32;
+  }
+
+  printf("%td keys, %u workers, best of %d trials (GB/s of keys read)\n", n,
+         __cilkrts_get_nworkers(), trials);
+  printf("%-10s %12s %12s %8s\n", "kernel", "serial", "pprim", "speedup");
+  int failures = 0;
+  for (size_t b = 0; b < NUM_BENCHES; ++b) {
+    uint64_t s, p;
+    double ts = best_time(benches[b].serial, a, src, n, benches[b].inPlace,
+                          trials, &s);
+    double tp = best_time(benches[b].parallel, a, src, n, benches[b].inPlace,
+                          trials, &p);
+    double gb = (double) n * sizeof(uint64_t) / 1e9;
+    printf("%-10s %12.3f %12.3f %8.2f%s\n", benches[b].name, gb / ts,
+           gb / tp, ts / tp, (s == p) ? "" : "  MISMATCH");
+    failures += (s != p);
+  }
+
+  free(src);
+  free(a);
+  return failures;
+}
@@ -0,0 +1,478 @@
+/* -*- c -*- */
+
+/**
+ * [Include-only header library]
+ * Generic parallel quicksort for Cilk, specialized per element type.
+ *
+ * @file        psort.h
+ * @version     1.0.0
+ * @license     MIT
+ */
+
+
+/**
+ * @mainpage
+ *
+ * @section overview Overview
+ *
+ * PSort is an include-only header library with the parallel quicksort of the
+ * `qsort.c` tutorial for element types other than `int`.  It comes in two
+ * flavors:
+ *
+ * - `PSORT_DEFINE()` / `PSORT_DEFINE_KEY()` :: macros that generate a sort
+ *   specialized for one element type, with the comparison inlined
+ * - `psort()`                                :: `qsort(3)`-style sort of
+ *   elements of any size, ordered by a comparator function
+ *
+ * Specializations for common key types are predefined:
+ * - `psort_int_sort()`    :: `int`
+ * - `psort_i64_sort()`    :: `int64_t`
+ * - `psort_u32_sort()`    :: `uint32_t`
+ * - `psort_u64_sort()`    :: `uint64_t`
+ * - `psort_float_sort()`  :: `float`
+ * - `psort_double_sort()` :: `double`
+ *
+ * @section algorithm Algorithm
+ *
+ * All variants pick the pivot of a range with Tukey's ninther (median of
+ * three for short ranges) and partition it in two, or in three
+ * (Dutch national flag) if the pivot candidates contain duplicate keys.  The
+ * two sides are sorted in parallel with `cilk_spawn`; ranges shorter than
+ * `PSORT_GRAINSIZE` elements are sorted serially, and ranges shorter than
+ * `PSORT_INSERTION_CUTOFF` by insertion sort.
+ *
+ * The sorts are not stable.  Orderings must be strict weak orderings; in
+ * particular, floating-point arrays must not contain NaNs.
+ *
+ * @section usage Using PSort
+ *
+ * @code
+ * struct kv { uint64_t key; uint32_t payload; };
+ * #define KV_KEY(x) ((x).key)
+ * PSORT_DEFINE_KEY(kv, struct kv, KV_KEY)
+ *
+ * kv_sort(records, records + n);
+ * @endcode
+ */
+
+
+#ifndef __H_PSORT__
+#define __H_PSORT__
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cilk/cilk.h>
+
+
+/**
+ * @defgroup psort PSort
+ *
+ * Generic parallel quicksort.
+ *
+ * @{
+ */
+
+
+/* ==================================================
+ * CONSTANTS
+ * ================================================== */
+
+
+/** Ranges shorter than this are sorted serially. */
+#ifndef PSORT_GRAINSIZE
+#define PSORT_GRAINSIZE 2048
+#endif
+
+/** Ranges shorter than this are sorted by insertion sort. */
+#ifndef PSORT_INSERTION_CUTOFF
+#define PSORT_INSERTION_CUTOFF 16
+#endif
+
+/** Ranges shorter than this pick the pivot by median of three. */
+#define PSORT_NINTHER_CUTOFF 128
+
+
+/* prevent C++ compilers from mangling function names */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ==================================================
+ * TYPE-SPECIALIZED SORTS
+ * ================================================== */
+
+
+/**
+ * @defgroup psort_typed Type-specialized sorts
+ *
+ * Macros that generate sorts specialized for one element type.
+ *
+ * @{
+ */
+
+
+/**
+ * Natural ordering for `PSORT_DEFINE()`, using the `<` operator.
+ */
+#define PSORT_LESS(x, y) ((x) < (y))
+
+
+/**
+ * Define a parallel sort of elements of type `type`:
+ *
+ * ```
+ * void <name>_sort(type * begin, type * end);
+ * ```
+ *
+ * which sorts the range `[begin, end)` into the order given by `less(x, y)`,
+ * a function or function-like macro that is true iff element `x` sorts before
+ * element `y`.  The generated helper functions are `static inline` and
+ * prefixed with `<name>_`.
+ */
+#define PSORT_DEFINE(name, type, less)                                        \
+                                                                              \
+static inline                                                                 \
+void name##_swap(type * a, type * b) {                                        \
+    type tmp = *a;                                                            \
+    *a = *b;                                                                  \
+    *b = tmp;                                                                 \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+void name##_insertion_sort(type * begin, type * end) {                        \
+    for (type * i = begin + 1; i < end; ++i) {                                \
+        type val = *i;                                                        \
+        type * j = i;                                                         \
+        while (j > begin && less(val, *(j - 1))) {                            \
+            *j = *(j - 1);                                                    \
+            --j;                                                              \
+        }                                                                     \
+        *j = val;                                                             \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+type * name##_median3(type * a, type * b, type * c, bool * dup) {             \
+    *dup |= !(less(*a, *b) || less(*b, *a))                                   \
+        || !(less(*b, *c) || less(*c, *b))                                    \
+        || !(less(*a, *c) || less(*c, *a));                                   \
+    if (less(*a, *b)) {                                                       \
+        if (less(*b, *c)) return b;                                           \
+        return less(*a, *c) ? c : a;                                          \
+    } else {                                                                  \
+        if (less(*a, *c)) return a;                                           \
+        return less(*b, *c) ? c : b;                                          \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+/* move the pivot to end - 1; true if the candidates had duplicates */       \
+static inline                                                                 \
+bool name##_choose_pivot(type * begin, type * end) {                          \
+    ptrdiff_t n = end - begin;                                                \
+    type * mid = begin + n / 2;                                               \
+    type * p;                                                                 \
+    bool dup = false;                                                         \
+    if (n < PSORT_NINTHER_CUTOFF) {                                           \
+        p = name##_median3(begin, mid, end - 1, &dup);                        \
+    } else {                                                                  \
+        ptrdiff_t s = n / 8;                                                  \
+        p = name##_median3(                                                   \
+            name##_median3(begin, begin + s, begin + 2 * s, &dup),            \
+            name##_median3(mid - s, mid, mid + s, &dup),                      \
+            name##_median3(end - 1 - 2 * s, end - 1 - s, end - 1, &dup),      \
+            &dup);                                                            \
+    }                                                                         \
+    name##_swap(p, end - 1);                                                  \
+    return dup;                                                               \
+}                                                                             \
+                                                                              \
+/* [begin, *lo) < pivot, [*lo, *hi) pivot (and equal keys), rest >= pivot */ \
+static inline                                                                 \
+void name##_pivot_partition(type * begin, type * end,                         \
+                            type ** lo, type ** hi) {                         \
+    bool dup = name##_choose_pivot(begin, end);                               \
+    type pivot = *(end - 1);                                                  \
+    if (dup) {                                                                \
+        /* three-way (Dutch national flag) partition */                       \
+        type * mid = begin;                                                   \
+        type * gt = end;                                                      \
+        while (mid < gt) {                                                    \
+            if (less(*mid, pivot)) {                                          \
+                name##_swap(begin++, mid++);                                  \
+            } else if (less(pivot, *mid)) {                                   \
+                name##_swap(mid, --gt);                                       \
+            } else {                                                          \
+                mid++;                                                        \
+            }                                                                 \
+        }                                                                     \
+        *lo = begin;                                                          \
+        *hi = gt;                                                             \
+    } else {                                                                  \
+        type * first = begin;                                                 \
+        type * last = end - 1;                                                \
+        while (first < last) {                                                \
+            if (less(*first, pivot)) {                                        \
+                first++;                                                      \
+            } else {                                                          \
+                last--;                                                       \
+                name##_swap(first, last);                                     \
+            }                                                                 \
+        }                                                                     \
+        name##_swap(end - 1, last);                                           \
+        *lo = last;                                                           \
+        *hi = last + 1;                                                       \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+void name##_serial_sort(type * begin, type * end) {                           \
+    while (end - begin > PSORT_INSERTION_CUTOFF) {                            \
+        type * lo;                                                            \
+        type * hi;                                                            \
+        name##_pivot_partition(begin, end, &lo, &hi);                         \
+        if (lo - begin < end - hi) {                                          \
+            name##_serial_sort(begin, lo);                                    \
+            begin = hi;                                                       \
+        } else {                                                              \
+            name##_serial_sort(hi, end);                                      \
+            end = lo;                                                         \
+        }                                                                     \
+    }                                                                         \
+    name##_insertion_sort(begin, end);                                        \
+}                                                                             \
+                                                                              \
+static inline                                                                 \
+void name##_sort(type * begin, type * end) {                                  \
+    if (end - begin < PSORT_GRAINSIZE) {                                      \
+        name##_serial_sort(begin, end);                                       \
+    } else {                                                                  \
+        type * lo;                                                            \
+        type * hi;                                                            \
+        name##_pivot_partition(begin, end, &lo, &hi);                         \
+        cilk_scope {                                                          \
+            cilk_spawn name##_sort(hi, end);                                  \
+            name##_sort(begin, lo);                                           \
+        }                                                                     \
+    }                                                                         \
+}
+
+
+/**
+ * Define a parallel sort of elements of type `type`, ordered by the key
+ * `key(x)` of each element `x` under `<`, where `key` is a function or
+ * function-like macro.  Generates the same functions as `PSORT_DEFINE()`,
+ * plus the ordering `<name>_key_less()`.
+ */
+#define PSORT_DEFINE_KEY(name, type, key)                                     \
+                                                                              \
+static inline                                                                 \
+bool name##_key_less(type const x, type const y) {                            \
+    return key(x) < key(y);                                                   \
+}                                                                             \
+                                                                              \
+PSORT_DEFINE(name, type, name##_key_less)
+
+
+PSORT_DEFINE(psort_int,    int,      PSORT_LESS)
+PSORT_DEFINE(psort_i64,    int64_t,  PSORT_LESS)
+PSORT_DEFINE(psort_u32,    uint32_t, PSORT_LESS)
+PSORT_DEFINE(psort_u64,    uint64_t, PSORT_LESS)
+PSORT_DEFINE(psort_float,  float,    PSORT_LESS)
+PSORT_DEFINE(psort_double, double,   PSORT_LESS)
+
+
+/** @} */ /* end group psort_typed */
+
+
+/* ==================================================
+ * COMPARATOR-BASED SORT
+ * ================================================== */
+
+
+/**
+ * @defgroup psort_generic Comparator-based sort
+ *
+ * Sort of elements of any size through a `qsort(3)`-style comparator.  Pays
+ * for an indirect call per comparison and a byte-wise swap; prefer a
+ * `PSORT_DEFINE()` specialization for hot paths.
+ *
+ * @{
+ */
+
+
+/**
+ * Comparator type of `psort()`: returns a negative, zero, or positive value
+ * if the first element sorts before, with, or after the second.
+ */
+typedef int (*psort_cmp_t)(void const *, void const *);
+
+
+/**
+ * Swap two `size`-byte elements.
+ */
+static inline
+void psort_swap_bytes(
+    char   * a,                 /**<[in,out] first element */
+    char   * b,                 /**<[in,out] second element */
+    size_t   size               /**<[in]     element size in bytes */
+) {
+    char tmp[64];
+    while (size > 0) {
+        size_t k = size < sizeof(tmp) ? size : sizeof(tmp);
+        memcpy(tmp, a, k);
+        memcpy(a, b, k);
+        memcpy(b, tmp, k);
+        a += k;
+        b += k;
+        size -= k;
+    }
+}
+
+
+static inline
+char * psort_median3_bytes(
+    char * a, char * b, char * c, psort_cmp_t cmp, bool * dup
+) {
+    int ab = cmp(a, b), bc = cmp(b, c), ac = cmp(a, c);
+    *dup |= (ab == 0) || (bc == 0) || (ac == 0);
+    if (ab < 0) {
+        if (bc < 0) return b;
+        return (ac < 0) ? c : a;
+    } else {
+        if (ac < 0) return a;
+        return (bc < 0) ? c : b;
+    }
+}
+
+
+/* Sort n elements at base; same scheme as the PSORT_DEFINE() sorts, with
+ * the pivot kept in the last slot of each range while it is partitioned. */
+static inline
+void psort_bytes(
+    char * base, size_t n, size_t size, psort_cmp_t cmp, bool parallel
+) {
+    while (n >= PSORT_INSERTION_CUTOFF) {
+        char * end = base + n * size;
+        char * last = end - size;
+
+        /* choose pivot */
+        char * mid = base + (n / 2) * size;
+        char * p;
+        bool dup = false;
+        if (n < PSORT_NINTHER_CUTOFF) {
+            p = psort_median3_bytes(base, mid, last, cmp, &dup);
+        } else {
+            size_t s = (n / 8) * size;
+            p = psort_median3_bytes(
+                psort_median3_bytes(base, base + s, base + 2 * s, cmp, &dup),
+                psort_median3_bytes(mid - s, mid, mid + s, cmp, &dup),
+                psort_median3_bytes(last - 2 * s, last - s, last, cmp, &dup),
+                cmp, &dup);
+        }
+        if (p != last)
+            psort_swap_bytes(p, last, size);
+
+        /* partition [base, last) around *last */
+        char * lo;
+        char * hi;
+        if (dup) {
+            char * lt = base;
+            char * cur = base;
+            char * gt = last;
+            while (cur < gt) {
+                int c = cmp(cur, last);
+                if (c < 0) {
+                    if (lt != cur)
+                        psort_swap_bytes(lt, cur, size);
+                    lt += size;
+                    cur += size;
+                } else if (c > 0) {
+                    gt -= size;
+                    psort_swap_bytes(cur, gt, size);
+                } else {
+                    cur += size;
+                }
+            }
+            /* [gt, last) > pivot: bring the pivot next to its equals */
+            if (gt != last)
+                psort_swap_bytes(gt, last, size);
+            lo = lt;
+            hi = gt + size;
+        } else {
+            char * first = base;
+            char * top = last;
+            while (first < top) {
+                if (cmp(first, last) < 0) {
+                    first += size;
+                } else {
+                    top -= size;
+                    psort_swap_bytes(first, top, size);
+                }
+            }
+            if (top != last)
+                psort_swap_bytes(top, last, size);
+            lo = top;
+            hi = top + size;
+        }
+
+        size_t nlo = (size_t)(lo - base) / size;
+        size_t nhi = (size_t)(end - hi) / size;
+        if (parallel && n >= PSORT_GRAINSIZE) {
+            cilk_scope {
+                cilk_spawn psort_bytes(hi, nhi, size, cmp, true);
+                psort_bytes(base, nlo, size, cmp, true);
+            }
+            return;
+        }
+        /* serial: recurse into the smaller side, loop on the larger */
+        if (nlo < nhi) {
+            psort_bytes(base, nlo, size, cmp, false);
+            base = hi;
+            n = nhi;
+        } else {
+            psort_bytes(hi, nhi, size, cmp, false);
+            n = nlo;
+        }
+    }
+
+    /* insertion sort */
+    char * end = base + n * size;
+    for (char * i = base + size; i < end; i += size) {
+        for (char * j = i; j > base && cmp(j, j - size) < 0; j -= size)
+            psort_swap_bytes(j, j - size, size);
+    }
+}
+
+
+/**
+ * Sort an array of `nmemb` elements of `size` bytes each in parallel, in the
+ * order given by `cmp`.  Drop-in replacement for `qsort(3)`.
+ */
+static inline
+void psort(
+    void        * base,         /**<[in,out] array to sort */
+    size_t        nmemb,        /**<[in]     number of elements */
+    size_t        size,         /**<[in]     element size in bytes */
+    psort_cmp_t   cmp           /**<[in]     element comparator */
+) {
+    psort_bytes((char *) base, nmemb, size, cmp, true);
+}
+
+
+/** @} */ /* end group psort_generic */
+
+
+#ifdef __cplusplus
+} /* end extern "C" */
+#endif
+
+
+/** @} */ /* end group psort */
+
+
+#endif  /* __H_PSORT__ */
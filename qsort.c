@@ -7,13 +7,125 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+// Pick the vector partition kernel for the target; -DQSORT_NO_SIMD forces
+// the scalar partition().
+#if !defined(QSORT_NO_SIMD) && defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_PARTITION_AVX512 1
+#define SIMD_PARTITION_ISA "avx512"
+#define SIMD_WIDTH 16
+#elif !defined(QSORT_NO_SIMD) && defined(__AVX2__) && defined(__BMI2__)
+#include <immintrin.h>
+#define SIMD_PARTITION_AVX2 1
+#define SIMD_PARTITION_ISA "avx2"
+#define SIMD_WIDTH 8
+#elif !defined(QSORT_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_PARTITION_NEON 1
+#define SIMD_PARTITION_ISA "neon"
+#define SIMD_WIDTH 4
+#else
+#define SIMD_PARTITION_ISA "scalar"
+#define SIMD_WIDTH 1
+#endif
 
 #include "ctimer.h"
+#include "instr.h"
+#include "pprim.h"
+#include "psort.h"
+
+// Ranges shorter than the grain size are not worth spawning: sample_qsort
+// finishes them with serial_qsort instead.  A grain size of 1 spawns all the
+// way down to single elements.
+#ifndef QSORT_GRAINSIZE
+#define QSORT_GRAINSIZE 2048
+#endif
+
+// serial_qsort hands ranges shorter than this to insertion_sort.
+#define INSERTION_SORT_CUTOFF 16
+
+// sample_qsort partitions ranges of at least this many elements with
+// parallel_partition, and shorter ones with the serial partition.
+#ifndef PARALLEL_PARTITION_CUTOFF
+#define PARALLEL_PARTITION_CUTOFF (1 << 17)
+#endif
+
+// Number of elements per block in parallel_partition.
+#define PARTITION_BLOCK 4096
+
+// choose_pivot uses a median of three for ranges shorter than this.
+#define NINTHER_CUTOFF 128
+
+// How choose_pivot picks the pivot of a range.
+enum pivot_rule {
+  PIVOT_LAST,     // last element (the original tutorial version)
+  PIVOT_MEDIAN3,  // median of first, middle and last elements
+  PIVOT_NINTHER   // Tukey's ninther: median of three medians of three
+};
+
+// How pivot_partition treats keys equal to the pivot.
+enum partition_mode {
+  PARTITION_TWO_WAY,    // with the keys greater than the pivot
+  PARTITION_THREE_WAY,  // in a block of their own (Dutch national flag)
+  PARTITION_AUTO        // three-way if the pivot sample has duplicates
+};
+
+// radix_sort sorts this many bits of the key per pass.
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Number of elements per block (and per histogram) in radix_sort.
+#define RADIX_BLOCK (1 << 16)
+
+static const char* const pivot_rule_names[] = {"last", "median3", "ninther"};
+static const char* const partition_mode_names[] = {
+  "two-way", "three-way", "auto"
+};
+
+static ptrdiff_t grainsize = QSORT_GRAINSIZE;
+static enum pivot_rule pivot_rule = PIVOT_NINTHER;
+static enum partition_mode partition_mode = PARTITION_AUTO;
+
+// Digit of key that radix_sort buckets on in the pass at shift.
+// The sign bit is flipped so that negative keys sort first.
+static inline unsigned radix_digit(int key, int shift) {
+  return (((unsigned) key ^ 0x80000000u) >> shift) & (RADIX_BUCKETS - 1);
+}
+
+// Build with -DQSORT_PHASE_TIMES to sum the time sample_qsort spends
+// partitioning and in serial base cases, over all workers.  Each lap is
+// timed by a stopwatch local to the task and added to a reducer, so the
+// hot path needs no atomics.
+#ifdef QSORT_PHASE_TIMES
+static ctimer_sum_t cilk_reducer(ctimer_sum_identity, ctimer_sum_reduce)
+  partition_time;
+static ctimer_sum_t cilk_reducer(ctimer_sum_identity, ctimer_sum_reduce)
+  base_case_time;
+#define PHASE_START(t) ctimer_t t; ctimer_start(&t)
+#define PHASE_STOP(t, sum) do { ctimer_stop(&t); ctimer_sum_add(&sum, &t); } while (0)
+#else
+#define PHASE_START(t)
+#define PHASE_STOP(t, sum)
+#endif
 
 void swap(int* a, int* b) {
   int tmp = *a;
@@ -37,30 +149,750 @@ int* partition(int* begin, int* end, int pivot) {
   return end;
 }
 
+// Vectorized version of partition() for the instruction set selected by
+// SIMD_PARTITION_ISA.  Each step loads SIMD_WIDTH keys, compares them with
+// the pivot all at once, and stores the keys less than the pivot at the
+// left write pointer and the rest at the right one, so the loop has no
+// data-dependent branches.  The first and last SIMD_WIDTH keys are set
+// aside up front, which leaves room for those stores, and each step reads
+// from the side with less room left, so the partition runs in place.
+// The set-aside keys and the < SIMD_WIDTH keys left over at the end are
+// placed with scalar code.  Same contract as partition(), which remains
+// the fallback (e.g. with -DQSORT_NO_SIMD) and the oracle that
+// check_simd_partition compares against.
+#if SIMD_WIDTH > 1
 
-// Sort the range between pointers begin and end.
-// end is one past the final element in the range.
-// Use the Quick Sort algorithm, using recursive divide and conquer.
-void sample_qsort(int* begin, int* end) {
-  if (begin < end) {
-    // get last element
-    int last = *(end - 1);
+// Partition the SIMD_WIDTH keys at src around pivot: keys less than pivot
+// are stored at *wl, which advances past them, and the others end at *wr,
+// which retreats before them.  Stores may clobber up to SIMD_WIDTH slots
+// on either side, which must not hold unread keys.
+static inline void simd_partition_block(const int* src, int pivot,
+                                        int** wl, int** wr) {
+#if SIMD_PARTITION_AVX512
+  __m512i v = _mm512_loadu_si512((const void *) src);
+  __mmask16 lt = _mm512_cmplt_epi32_mask(v, _mm512_set1_epi32(pivot));
+  int nlow = __builtin_popcount(lt);
+  int nhigh = SIMD_WIDTH - nlow;
+  _mm512_storeu_si512((void *) *wl, _mm512_maskz_compress_epi32(lt, v));
+  _mm512_mask_storeu_epi32((void *) (*wr - nhigh),
+                           (__mmask16) ((1u << nhigh) - 1),
+                           _mm512_maskz_compress_epi32((__mmask16) ~lt, v));
+#elif SIMD_PARTITION_AVX2
+  __m256i v = _mm256_loadu_si256((const __m256i *) src);
+  __m256i lt = _mm256_cmpgt_epi32(_mm256_set1_epi32(pivot), v);
+  unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(lt));
+  int nlow = __builtin_popcount(mask);
+  // byte-wide lane indices of the keys < pivot, then of the others
+  uint64_t bytes = _pdep_u64(mask, 0x0101010101010101ull) * 0xff;
+  uint64_t lows = _pext_u64(0x0706050403020100ull, bytes);
+  uint64_t highs = _pext_u64(0x0706050403020100ull, ~bytes);
+  uint64_t perm = (nlow == SIMD_WIDTH) ? lows : lows | (highs << (8 * nlow));
+  __m256i p = _mm256_permutevar8x32_epi32(
+      v, _mm256_cvtepu8_epi32(_mm_cvtsi64_si128((long long) perm)));
+  _mm256_storeu_si256((__m256i *) *wl, p);
+  _mm256_storeu_si256((__m256i *) (*wr - SIMD_WIDTH), p);
+#elif SIMD_PARTITION_NEON
+  // byte shuffles that move the keys < pivot to the front, indexed by
+  // the comparison mask
+  static const uint8_t perms[16][16] = {
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 4,  5,  6,  7,  0,  1,  2,  3,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    { 8,  9, 10, 11,  0,  1,  2,  3,  4,  5,  6,  7, 12, 13, 14, 15},
+    { 0,  1,  2,  3,  8,  9, 10, 11,  4,  5,  6,  7, 12, 13, 14, 15},
+    { 4,  5,  6,  7,  8,  9, 10, 11,  0,  1,  2,  3, 12, 13, 14, 15},
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+    {12, 13, 14, 15,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11},
+    { 0,  1,  2,  3, 12, 13, 14, 15,  4,  5,  6,  7,  8,  9, 10, 11},
+    { 4,  5,  6,  7, 12, 13, 14, 15,  0,  1,  2,  3,  8,  9, 10, 11},
+    { 0,  1,  2,  3,  4,  5,  6,  7, 12, 13, 14, 15,  8,  9, 10, 11},
+    { 8,  9, 10, 11, 12, 13, 14, 15,  0,  1,  2,  3,  4,  5,  6,  7},
+    { 0,  1,  2,  3,  8,  9, 10, 11, 12, 13, 14, 15,  4,  5,  6,  7},
+    { 4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,  0,  1,  2,  3},
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+  };
+  static const uint32_t bits[4] = {1, 2, 4, 8};
+  int32x4_t v = vld1q_s32(src);
+  uint32x4_t lt = vcltq_s32(v, vdupq_n_s32(pivot));
+  unsigned mask = vaddvq_u32(vandq_u32(lt, vld1q_u32(bits)));
+  int nlow = __builtin_popcount(mask);
+  int32x4_t p = vreinterpretq_s32_u8(
+      vqtbl1q_u8(vreinterpretq_u8_s32(v), vld1q_u8(perms[mask])));
+  vst1q_s32(*wl, p);
+  vst1q_s32(*wr - SIMD_WIDTH, p);
+#endif
+  *wl += nlow;
+  *wr -= SIMD_WIDTH - nlow;
+}
+
+int* simd_partition(int* begin, int* end, int pivot) {
+  if (end - begin < 2 * SIMD_WIDTH) {
+    return partition(begin, end, pivot);
+  }
+
+  // keys held back by the vector loop: the first and last vectors, plus
+  // whatever is left over at the end
+  int spill[3 * SIMD_WIDTH];
+  memcpy(spill, begin, sizeof(int)*SIMD_WIDTH);
+  memcpy(spill + SIMD_WIDTH, end - SIMD_WIDTH, sizeof(int)*SIMD_WIDTH);
+
+  // [readL, readR) is unread; [begin, writeL) and [writeR, end) are done
+  int* readL = begin + SIMD_WIDTH;
+  int* readR = end - SIMD_WIDTH;
+  int* writeL = begin;
+  int* writeR = end;
+  while (readR - readL >= SIMD_WIDTH) {
+    const int* src;
+    if (readL - writeL <= writeR - readR) {
+      src = readL;
+      readL += SIMD_WIDTH;
+    } else {
+      readR -= SIMD_WIDTH;
+      src = readR;
+    }
+    simd_partition_block(src, pivot, &writeL, &writeR);
+  }
+
+  ptrdiff_t nspill = 2 * SIMD_WIDTH + (readR - readL);
+  memcpy(spill + 2 * SIMD_WIDTH, readL, sizeof(int)*(readR - readL));
+  for (ptrdiff_t i = 0; i < nspill; ++i) {
+    if (spill[i] < pivot) {
+      *writeL++ = spill[i];
+    } else {
+      *--writeR = spill[i];
+    }
+  }
+  return writeL;
+}
+
+#else
+
+int* simd_partition(int* begin, int* end, int pivot) {
+  return partition(begin, end, pivot);
+}
+
+#endif  // SIMD_WIDTH > 1
+
+// Number of elements per block in block_partition; offsets into a block
+// must fit in an unsigned char.
+#define BLOCK_PARTITION_BLOCK 128
+
+// block_partition prefetches the blocks this many blocks ahead of each
+// end.
+#define BLOCK_PARTITION_PREFETCH 4
+
+// Prefetch the BLOCK_PARTITION_BLOCK elements at p for writing.
+static inline void prefetch_block(const int* p) {
+  for (int i = 0; i < BLOCK_PARTITION_BLOCK; i += 64 / sizeof(int)) {
+    __builtin_prefetch(p + i, 1);
+  }
+}
+
+// Partition array like partition(), with the branch-free block scheme of
+// BlockQuicksort (Edelkamp and Weiss).  The range is consumed from both
+// ends one block at a time.  A first pass over each block records the
+// offsets of the misplaced elements, adding the comparison to the count
+// instead of branching on it, and a second pass swaps misplaced elements
+// of the left and right blocks pairwise.  The only branches left depend
+// on block counts, not on keys.  Each new block also prefetches the one
+// BLOCK_PARTITION_PREFETCH blocks further in, so once the range is DRAM
+// resident both streams are in flight ahead of the loop.  The last < 2
+// blocks are finished by partition().
+int* block_partition(int* begin, int* end, int pivot) {
+  unsigned char offL[BLOCK_PARTITION_BLOCK], offR[BLOCK_PARTITION_BLOCK];
+  int numL = 0, numR = 0, startL = 0, startR = 0;
+  const ptrdiff_t ahead = BLOCK_PARTITION_PREFETCH * BLOCK_PARTITION_BLOCK;
+
+  // [l, r) is not known to be partitioned
+  int* l = begin;
+  int* r = end;
+  while (r - l >= 2 * BLOCK_PARTITION_BLOCK) {
+    bool prefetch = (r - l >= 2 * (ahead + BLOCK_PARTITION_BLOCK));
+    if (numL == 0) {
+      startL = 0;
+      if (prefetch) {
+        prefetch_block(l + ahead);
+      }
+      for (int i = 0; i < BLOCK_PARTITION_BLOCK; ++i) {
+        offL[numL] = i;
+        numL += (l[i] >= pivot);
+      }
+    }
+    if (numR == 0) {
+      startR = 0;
+      if (prefetch) {
+        prefetch_block(r - ahead - BLOCK_PARTITION_BLOCK);
+      }
+      for (int i = 0; i < BLOCK_PARTITION_BLOCK; ++i) {
+        offR[numR] = i;
+        numR += (r[-1 - i] < pivot);
+      }
+    }
+
+    int num = (numL < numR) ? numL : numR;
+    for (int j = 0; j < num; ++j) {
+      swap(l + offL[startL + j], r - 1 - offR[startR + j]);
+    }
+    numL -= num;
+    numR -= num;
+    startL += num;
+    startR += num;
+    if (numL == 0) {
+      l += BLOCK_PARTITION_BLOCK;
+    }
+    if (numR == 0) {
+      r -= BLOCK_PARTITION_BLOCK;
+    }
+  }
+
+  // a block with misplaced elements left over is rescanned
+  return partition(l, r, pivot);
+}
+
+// The serial partition kernels pivot_partition can use.
+enum partition_kernel {
+  KERNEL_SCALAR,  // partition()
+  KERNEL_SIMD,    // simd_partition()
+  KERNEL_BLOCK    // block_partition()
+};
+
+static const char* const partition_kernel_names[] = {
+  "scalar", "simd", "block"
+};
+
+static enum partition_kernel partition_kernel = KERNEL_SIMD;
+
+// Partition array like partition(), with the kernel selected by
+// partition_kernel.
+int* serial_partition(int* begin, int* end, int pivot) {
+  switch (partition_kernel) {
+  case KERNEL_SCALAR:
+    return partition(begin, end, pivot);
+  case KERNEL_BLOCK:
+    return block_partition(begin, end, pivot);
+  default:
+    return simd_partition(begin, end, pivot);
+  }
+}
+
+// Partition array like partition(), but in parallel.
+// Each block of PARTITION_BLOCK elements counts its elements less than
+// pivot; a prefix sum over the counts gives every block its offsets in
+// a scratch buffer, into which the blocks scatter their elements in
+// parallel before the buffer is copied back.  Falls back to the serial
+// partition kernel if the scratch buffer cannot be allocated.
+int* parallel_partition(int* begin, int* end, int pivot) {
+  ptrdiff_t n = end - begin;
+  ptrdiff_t nblocks = (n + PARTITION_BLOCK - 1) / PARTITION_BLOCK;
+  int* tmp = (int *) malloc(sizeof(int)*n);
+  ptrdiff_t* lows = (ptrdiff_t *) malloc(sizeof(ptrdiff_t)*nblocks);
+  if (!tmp || !lows) {
+    free(tmp);
+    free(lows);
+    return serial_partition(begin, end, pivot);
+  }
+
+  // count the elements less than pivot in each block
+  cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+    const int* lo = begin + b * PARTITION_BLOCK;
+    const int* hi = (b == nblocks - 1) ? end : lo + PARTITION_BLOCK;
+    ptrdiff_t count = 0;
+    for (const int* p = lo; p < hi; ++p) {
+      count += (*p < pivot);
+    }
+    lows[b] = count;
+  }
+
+  // exclusive prefix sum: lows[b] = # elements < pivot before block b
+  ptrdiff_t nlow = pprim_ptrdiff_exclusive_scan(lows, nblocks);
+
+  // scatter each block to its slots in the lower and upper partitions
+  cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+    ptrdiff_t offset = b * PARTITION_BLOCK;
+    const int* lo = begin + offset;
+    const int* hi = (b == nblocks - 1) ? end : lo + PARTITION_BLOCK;
+    int* low = tmp + lows[b];
+    int* high = tmp + nlow + (offset - lows[b]);
+    for (const int* p = lo; p < hi; ++p) {
+      if (*p < pivot) {
+        *low++ = *p;
+      } else {
+        *high++ = *p;
+      }
+    }
+  }
+
+  cilk_for (ptrdiff_t i = 0; i < n; ++i) {
+    begin[i] = tmp[i];
+  }
+
+  free(tmp);
+  free(lows);
+  return begin + nlow;
+}
+
+// Sort the range between pointers begin and end by straight insertion.
+// Only used for short ranges.
+void insertion_sort(int* begin, int* end) {
+  for (int* i = begin + 1; i < end; ++i) {
+    int val = *i;
+    int* j = i;
+    while (j > begin && *(j - 1) > val) {
+      *j = *(j - 1);
+      --j;
+    }
+    *j = val;
+  }
+}
 
+// Three-way (Dutch national flag) partition of the range between pointers
+// begin and end around pivot.  On return [begin, *lt) holds the elements
+// less than pivot, [*lt, *gt) the elements equal to pivot, and [*gt, end)
+// the elements greater than pivot.
+void partition3(int* begin, int* end, int pivot, int** lt, int** gt) {
+  int* mid = begin;
+  while (mid < end) {
+    if (*mid < pivot) {
+      swap(begin++, mid++);
+    } else if (*mid > pivot) {
+      swap(mid, --end);
+    } else {
+      mid++;
+    }
+  }
+  *lt = begin;
+  *gt = end;
+}
+
+// Return a pointer to the median of *a, *b and *c.
+// Sets *dup if two of the three are equal.
+int* median3(int* a, int* b, int* c, bool* dup) {
+  *dup |= (*a == *b) || (*b == *c) || (*a == *c);
+  if (*a < *b) {
+    if (*b < *c) return b;
+    return (*a < *c) ? c : a;
+  } else {
+    if (*a < *c) return a;
+    return (*b < *c) ? c : b;
+  }
+}
+
+// Choose a pivot for the range between pointers begin and end according
+// to pivot_rule and move it to the last position of the range.
+// Returns true if the sampled candidates contained duplicate keys.
+bool choose_pivot(int* begin, int* end) {
+  ptrdiff_t n = end - begin;
+  int* mid = begin + n / 2;
+  int* p;
+  bool dup = false;
+  switch (pivot_rule) {
+  case PIVOT_LAST:
+    return false;
+  case PIVOT_MEDIAN3:
+    p = median3(begin, mid, end - 1, &dup);
+    break;
+  case PIVOT_NINTHER:
+  default:
+    if (n < NINTHER_CUTOFF) {
+      p = median3(begin, mid, end - 1, &dup);
+    } else {
+      // median of the medians of three evenly spaced triples
+      ptrdiff_t s = n / 8;
+      p = median3(median3(begin, begin + s, begin + 2 * s, &dup),
+                  median3(mid - s, mid, mid + s, &dup),
+                  median3(end - 1 - 2 * s, end - 1 - s, end - 1, &dup),
+                  &dup);
+    }
+    break;
+  }
+  swap(p, end - 1);
+  return dup;
+}
+
+// Partition the (nonempty) range between pointers begin and end around a
+// pivot picked by choose_pivot, in parallel for large ranges.
+// On return [begin, *lo) holds elements less than the pivot and [*hi, end)
+// elements not less than it.  [*lo, *hi) is the pivot itself, or, for a
+// three-way partition, every element equal to the pivot, so that
+// duplicate-heavy ranges shrink quickly.  In PARTITION_AUTO mode, a range
+// is partitioned three ways if the pivot candidates contained duplicates.
+void pivot_partition(int* begin, int* end, int** lo, int** hi) {
+  bool dup = choose_pivot(begin, end);
+  bool three_way = (partition_mode == PARTITION_THREE_WAY)
+    || (partition_mode == PARTITION_AUTO && dup);
+  int last = *(end - 1);
+  bool parallel = (end - begin >= PARALLEL_PARTITION_CUTOFF);
+
+  if (three_way && !parallel) {
+    partition3(begin, end, last, lo, hi);
+  } else if (three_way) {
+    // two parallel passes: split off the elements < last, then split
+    // the rest into the elements == last and > last
+    int* middle = parallel_partition(begin, end, last);
+    *lo = middle;
+    *hi = (last < INT_MAX) ? parallel_partition(middle, end, last + 1) : end;
+  } else {
     // we give partition a pointer to the first element and one past the last element
     // of the range we want to partition
     // move all values which are >= last to the end
     // move all value which are < last to the beginning
     // return a pointer to the first element >= last
-    int * middle = partition(begin, end - 1, last);
+    int * middle = parallel
+      ? parallel_partition(begin, end - 1, last)
+      : serial_partition(begin, end - 1, last);
 
     // move pivot to middle
     swap((end - 1), middle);
+    *lo = middle;
+    *hi = middle + 1;
+  }
+}
+
+// Sort the range between pointers begin and end serially.
+// Same partitioning scheme as sample_qsort, but recurses only into the
+// smaller side and loops on the larger one, so the stack depth stays
+// logarithmic in the size of the range.
+void serial_qsort(int* begin, int* end) {
+  while (end - begin > INSERTION_SORT_CUTOFF) {
+    int *lo, *hi;
+    pivot_partition(begin, end, &lo, &hi);
+    if (lo - begin < end - hi) {
+      serial_qsort(begin, lo);
+      begin = hi;
+    } else {
+      serial_qsort(hi, end);
+      end = lo;
+    }
+  }
+  insertion_sort(begin, end);
+}
+
+// Sort the range between pointers begin and end.
+// end is one past the final element in the range.
+// Use the Quick Sort algorithm, using recursive divide and conquer.
+// Ranges shorter than grainsize are sorted serially.
+void sample_qsort(int* begin, int* end) {
+  if (end - begin < grainsize) {
+    // too small to be worth spawning
+    PHASE_START(t);
+    serial_qsort(begin, end);
+    PHASE_STOP(t, base_case_time);
+  } else if (begin < end) {
+    // [lo, hi) is in its final place: the pivot, plus its duplicates
+    // in three-way mode
+    int *lo, *hi;
+    PHASE_START(t);
+    pivot_partition(begin, end, &lo, &hi);
+    PHASE_STOP(t, partition_time);
 
     // sort in parallel
     cilk_scope {
-      cilk_spawn sample_qsort(middle+1, end); // sort upper partition w/o pivot
-      sample_qsort(begin, middle); // sort lower partition
+      cilk_spawn sample_qsort(hi, end); // sort upper partition w/o pivot
+      sample_qsort(begin, lo); // sort lower partition
+    }
+  }
+}
+
+// Sort the range between pointers begin and end with a parallel
+// least-significant-digit radix sort, RADIX_BITS bits per pass.
+// Each block of RADIX_BLOCK elements builds its own digit histogram, so
+// the counting needs no synchronization.  The histograms are stored
+// digit-major, so a parallel prefix sum over them in (digit, block) order
+// gives each block its output offsets, and the blocks then scatter their
+// elements stably in parallel.  Passes ping-pong
+// between the array and a scratch buffer.  A pass is skipped if every key
+// has the same digit.  Falls back to sample_qsort if the scratch buffers
+// cannot be allocated.
+void radix_sort(int* begin, int* end) {
+  ptrdiff_t n = end - begin;
+  if (n < 2) {
+    return;
+  }
+  ptrdiff_t nblocks = (n + RADIX_BLOCK - 1) / RADIX_BLOCK;
+  int* tmp = (int *) malloc(sizeof(int)*n);
+  ptrdiff_t* hist =
+    (ptrdiff_t *) malloc(sizeof(ptrdiff_t)*nblocks*RADIX_BUCKETS);
+  if (!tmp || !hist) {
+    free(tmp);
+    free(hist);
+    sample_qsort(begin, end);
+    return;
+  }
+
+  int* src = begin;
+  int* dst = tmp;
+  for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+    // histogram of this digit in each block: hist[d * nblocks + b]
+    cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+      ptrdiff_t h[RADIX_BUCKETS] = {0};
+      const int* lo = src + b * RADIX_BLOCK;
+      const int* hi = (b == nblocks - 1) ? src + n : lo + RADIX_BLOCK;
+      for (const int* p = lo; p < hi; ++p) {
+        h[radix_digit(*p, shift)]++;
+      }
+      for (int d = 0; d < RADIX_BUCKETS; ++d) {
+        hist[d * nblocks + b] = h[d];
+      }
+    }
+
+    // exclusive prefix sum, all blocks of digit 0 first, then digit 1, ...
+    pprim_ptrdiff_exclusive_scan(hist, nblocks * RADIX_BUCKETS);
+    bool trivial = false;
+    for (int d = 0; d < RADIX_BUCKETS; ++d) {
+      ptrdiff_t next = (d == RADIX_BUCKETS - 1) ? n : hist[(d + 1) * nblocks];
+      trivial |= (next - hist[d * nblocks] == n);
+    }
+    if (trivial) {
+      continue;
+    }
+
+    // stable scatter of each block to its offsets
+    cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+      ptrdiff_t h[RADIX_BUCKETS];
+      for (int d = 0; d < RADIX_BUCKETS; ++d) {
+        h[d] = hist[d * nblocks + b];
+      }
+      const int* lo = src + b * RADIX_BLOCK;
+      const int* hi = (b == nblocks - 1) ? src + n : lo + RADIX_BLOCK;
+      for (const int* p = lo; p < hi; ++p) {
+        dst[h[radix_digit(*p, shift)]++] = *p;
+      }
+    }
+
+    int* swp = src;
+    src = dst;
+    dst = swp;
+  }
+
+  if (src != begin) {
+    cilk_for (ptrdiff_t i = 0; i < n; ++i) {
+      begin[i] = src[i];
+    }
+  }
+
+  free(tmp);
+  free(hist);
+}
+
+// Ranges shorter than this are sorted serially by merge_sort.
+#define MERGE_SORT_CUTOFF 2048
+
+// Merges with fewer elements than this are done serially by parallel_merge.
+#define MERGE_CUTOFF 8192
+
+// Return the first position in the sorted range [begin, end) whose element
+// is not less than key.
+static const int* lower_bound(const int* begin, const int* end, int key) {
+  while (begin < end) {
+    const int* mid = begin + (end - begin) / 2;
+    if (*mid < key) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin;
+}
+
+// Merge the sorted ranges [a, aEnd) and [b, bEnd) into out.
+void serial_merge(const int* a, const int* aEnd, const int* b,
+                  const int* bEnd, int* out) {
+  while (a < aEnd && b < bEnd) {
+    *out++ = (*b < *a) ? *b++ : *a++;
+  }
+  memcpy(out, a, sizeof(int)*(aEnd - a));
+  out += aEnd - a;
+  memcpy(out, b, sizeof(int)*(bEnd - b));
+}
+
+// Merge the sorted ranges [a, aEnd) and [b, bEnd) into out, in parallel.
+// The middle element of the larger range splits it in two, a binary search
+// splits the other range at the same key, and the two pairs of halves are
+// merged in parallel on either side of the middle element.  Either merge
+// gets at most three quarters of the elements, so the span is O(log^2 n).
+void parallel_merge(const int* a, const int* aEnd, const int* b,
+                    const int* bEnd, int* out) {
+  if (aEnd - a < bEnd - b) {
+    const int* t = a;
+    a = b;
+    b = t;
+    t = aEnd;
+    aEnd = bEnd;
+    bEnd = t;
+  }
+  if ((aEnd - a) + (bEnd - b) < MERGE_CUTOFF) {
+    serial_merge(a, aEnd, b, bEnd, out);
+    return;
+  }
+
+  const int* aMid = a + (aEnd - a) / 2;
+  const int* bMid = lower_bound(b, bEnd, *aMid);
+  int* outMid = out + (aMid - a) + (bMid - b);
+  *outMid = *aMid;
+  cilk_scope {
+    cilk_spawn parallel_merge(a, aMid, b, bMid, out);
+    parallel_merge(aMid + 1, aEnd, bMid, bEnd, outMid + 1);
+  }
+}
+
+// Sort the n elements of src, leaving the result in src if toTmp is false
+// and in tmp, which has room for n elements, otherwise.  The halves are
+// sorted into the other buffer and merged back, so the two buffers trade
+// places at every level and no level allocates.
+static void merge_sort_into(int* src, int* tmp, ptrdiff_t n, bool toTmp) {
+  if (n < MERGE_SORT_CUTOFF) {
+    serial_qsort(src, src + n);
+    if (toTmp) {
+      memcpy(tmp, src, sizeof(int)*n);
+    }
+    return;
+  }
+
+  ptrdiff_t half = n / 2;
+  cilk_scope {
+    cilk_spawn merge_sort_into(src, tmp, half, !toTmp);
+    merge_sort_into(src + half, tmp + half, n - half, !toTmp);
+  }
+
+  int* from = toTmp ? src : tmp;
+  int* to = toTmp ? tmp : src;
+  parallel_merge(from, from + half, from + half, from + n, to);
+}
+
+// Sort the range between pointers begin and end with a parallel merge
+// sort: divide and conquer with parallel_merge, for O(log^3 n) span
+// whatever the input.  One scratch buffer the size of the range is
+// allocated up front.  Falls back to sample_qsort if it cannot be.
+void merge_sort(int* begin, int* end) {
+  ptrdiff_t n = end - begin;
+  int* tmp = (int *) malloc(sizeof(int)*n);
+  if (!tmp) {
+    sample_qsort(begin, end);
+    return;
+  }
+  merge_sort_into(begin, tmp, n, false);
+  free(tmp);
+}
+
+// Rearrange the range between pointers begin and end so that *nth is the
+// element that would be there if the range were sorted, with no greater
+// element before it and no smaller one after it.  This is quickselect on
+// pivot_partition: only the side holding nth is partitioned further, so
+// the expected work is O(n), and the large partitions at the top run in
+// parallel.
+void nth_element(int* begin, int* nth, int* end) {
+  while (end - begin > INSERTION_SORT_CUTOFF) {
+    int *lo, *hi;
+    pivot_partition(begin, end, &lo, &hi);
+    if (nth < lo) {
+      end = lo;
+    } else if (nth >= hi) {
+      begin = hi;
+    } else {
+      return;  // nth is in the block of pivots
+    }
+  }
+  insertion_sort(begin, end);
+}
+
+// Put the middle - begin smallest elements of the range between pointers
+// begin and end, sorted, into [begin, middle).  The rest of the range ends
+// up in no particular order.  nth_element isolates the prefix, and only
+// the prefix is sorted, with sample_qsort.
+void partial_sort(int* begin, int* middle, int* end) {
+  if (middle < end) {
+    nth_element(begin, middle, end);
+  }
+  sample_qsort(begin, middle);
+}
+
+// Segments of at most this many elements are sorted by network_sort.
+#define SORT_NETWORK_SIZE 8
+
+// Segments at least this long are sorted in parallel by sample_qsort.
+#define SEGMENT_PARALLEL_CUTOFF (1 << 16)
+
+// sort_segments hands groups of segments of about this many elements in
+// total to one strand.
+#define SEGMENT_BATCH_GRAIN (1 << 14)
+
+// Batcher's odd-even merge network for 8 inputs: 19 compare-exchanges.
+static const unsigned char sort_network8[19][2] = {
+  {0, 1}, {2, 3}, {4, 5}, {6, 7},
+  {0, 2}, {1, 3}, {4, 6}, {5, 7},
+  {1, 2}, {5, 6},
+  {0, 4}, {1, 5}, {2, 6}, {3, 7},
+  {2, 4}, {3, 5},
+  {1, 2}, {3, 4}, {5, 6},
+};
+
+// Sort the at most SORT_NETWORK_SIZE elements between pointers begin and
+// end with a sorting network, which compiles to min/max instructions
+// without branches.  Short ranges are padded with INT_MAX.
+void network_sort(int* begin, int* end) {
+  ptrdiff_t n = end - begin;
+  int v[SORT_NETWORK_SIZE];
+  for (int i = 0; i < SORT_NETWORK_SIZE; ++i) {
+    v[i] = (i < n) ? begin[i] : INT_MAX;
+  }
+  for (int k = 0; k < 19; ++k) {
+    int x = v[sort_network8[k][0]];
+    int y = v[sort_network8[k][1]];
+    v[sort_network8[k][0]] = (x < y) ? x : y;
+    v[sort_network8[k][1]] = (x < y) ? y : x;
+  }
+  memcpy(begin, v, sizeof(int)*n);
+}
+
+// Sort one segment of a batch: by the network if it is tiny, serially if
+// it is small, and in parallel if it is huge.
+static void sort_segment(int* begin, int* end) {
+  ptrdiff_t n = end - begin;
+  if (n < 2) {
+    return;
+  } else if (n <= SORT_NETWORK_SIZE) {
+    network_sort(begin, end);
+  } else if (n < SEGMENT_PARALLEL_CUTOFF) {
+    serial_qsort(begin, end);
+  } else {
+    sample_qsort(begin, end);
+  }
+}
+
+// Sort segments [s, t) of a batch.  Groups of segments with more than
+// SEGMENT_BATCH_GRAIN elements are cut in two at the segment boundary
+// nearest to their middle element, so the halves spawned get similar
+// work however the segment sizes vary.
+static void sort_segment_range(int* a, const ptrdiff_t* offsets,
+                               ptrdiff_t s, ptrdiff_t t) {
+  while (t - s > 1 && offsets[t] - offsets[s] > SEGMENT_BATCH_GRAIN) {
+    // smallest m in (s, t) with offsets[m] >= the middle element
+    ptrdiff_t middle = offsets[s] + (offsets[t] - offsets[s]) / 2;
+    ptrdiff_t lo = s + 1, hi = t - 1;
+    while (lo < hi) {
+      ptrdiff_t m = lo + (hi - lo) / 2;
+      if (offsets[m] < middle) {
+        lo = m + 1;
+      } else {
+        hi = m;
+      }
     }
+    cilk_spawn sort_segment_range(a, offsets, s, lo);
+    s = lo;
+  }
+  for (ptrdiff_t i = s; i < t; ++i) {
+    sort_segment(a + offsets[i], a + offsets[i+1]);
+  }
+  cilk_sync;
+}
+
+// Sort each of the nsegs independent segments a[offsets[i]..offsets[i+1])
+// of a batch, in parallel across segments and, for huge segments, inside
+// them.  offsets has nsegs + 1 nondecreasing entries.
+void sort_segments(int* a, const ptrdiff_t* offsets, ptrdiff_t nsegs) {
+  if (nsegs > 0) {
+    sort_segment_range(a, offsets, 0, nsegs);
   }
 }
 
@@ -74,72 +906,1592 @@ void print_array(const int *a, size_t n) {
   printf(")\n");
 }
 
-// A simple test harness.  Program takes 2 optional arguments:
-//   First argument specifies the length of the array to sort.
-//   Defaults to 10 thousand.
-//   Second argument specifies the number of trials to run.
-//   Defaults to 1.
-int main(int argc, char **argv) {
-  int *a = NULL, failCount = 0;
-  int failFlag;
+// Largest prefix of the input that autotune_grainsize sorts per candidate.
+#define AUTOTUNE_SAMPLE (1 << 20)
 
-  // get number of integers to sort, default 1 million
-  int n = 1000*1000;
-  if (argc > 1) {
-    n = atoi(argv[1]);
+// Pick a grain size for sample_qsort by timing it on a copy of (a prefix of)
+// the input for each power-of-two grain size and keeping the fastest.
+ptrdiff_t autotune_grainsize(const int* a, int n) {
+  int m = n < AUTOTUNE_SAMPLE ? n : AUTOTUNE_SAMPLE;
+  int* sample = (int *) malloc(sizeof(int)*m);
+  if (!sample) {
+    return QSORT_GRAINSIZE;
   }
-  printf("Sorting %d integers\n", n);
 
-  // check arguments
-  if (n < 1) {
-    printf("array length must be positive\n");
+  ptrdiff_t best = QSORT_GRAINSIZE;
+  long bestTime = -1;
+  for (ptrdiff_t g = 8; g <= m && g <= (1 << 16); g *= 2) {
+    memcpy(sample, a, sizeof(int)*m);
+    grainsize = g;
+
+    ctimer_t t;
+    ctimer_start(&t);
+    sample_qsort(sample, sample + m);
+    ctimer_stop(&t);
+    ctimer_measure(&t);
+
+    long ns = timespec_nsec(t.elapsed);
+    if (bestTime < 0 || ns < bestTime) {
+      bestTime = ns;
+      best = g;
+    }
+  }
+
+  free(sample);
+  return best;
+}
+
+// Seed of the harness input.
+#define INPUT_SEED 13
+
+// Number of pivots check_partition tries.
+#define CHECK_PARTITION_PIVOTS 8
+
+static int compare_ints(const void* x, const void* y) {
+  int a = *(const int *) x, b = *(const int *) y;
+  return (a > b) - (a < b);
+}
+
+// Check a partition kernel against partition() on copies of a, with
+// pivots taken from a.  Both must split at the same point and put the same
+// keys on each side.  Returns the number of pivots that disagree.
+int check_partition(const int* a, int n, int* (*kernel)(int*, int*, int)) {
+  int* x = (int *) malloc(sizeof(int)*n);
+  int* y = (int *) malloc(sizeof(int)*n);
+  if (!x || !y) {
+    printf("array allocation failed\n");
     exit(-1);
   }
 
-  // allocate memory for array
-  a = (int *) malloc(sizeof(int)*n);
-  if (!a) {
+  int mismatches = 0;
+  for (int k = 0; k < CHECK_PARTITION_PIVOTS; ++k) {
+    int pivot = a[(long)n * k / CHECK_PARTITION_PIVOTS];
+    memcpy(x, a, sizeof(int)*n);
+    memcpy(y, a, sizeof(int)*n);
+    int* mx = partition(x, x + n, pivot);
+    int* my = kernel(y, y + n, pivot);
+    ptrdiff_t m = mx - x;
+    bool ok = (my - y == m);
+    if (ok) {
+      qsort(x, m, sizeof(int), compare_ints);
+      qsort(x + m, n - m, sizeof(int), compare_ints);
+      qsort(y, m, sizeof(int), compare_ints);
+      qsort(y + m, n - m, sizeof(int), compare_ints);
+      ok = (memcmp(x, y, sizeof(int)*n) == 0);
+    }
+    if (!ok) {
+#ifdef DEBUG
+      printf("partition kernel mismatch for pivot %d\n", pivot);
+#endif
+      ++mismatches;
+    }
+  }
+
+  free(x);
+  free(y);
+  return mismatches;
+}
+
+// Partition kernels bench_partition times.
+static const struct {
+  const char* name;
+  int* (*partition)(int*, int*, int);
+} partition_benches[] = {
+  {"partition", partition},
+  {"simd_partition", simd_partition},
+  {"block_partition", block_partition},
+  {"parallel_partition", parallel_partition},
+};
+
+// Time each partition kernel alone on copies of a, around the pivot a[n/2],
+// and print the best of trials runs as the bytes of array partitioned per
+// second, to compare with the memory bandwidth.  Returns the number of
+// kernels whose output is not partitioned.
+int bench_partition(const int* a, int n, int trials) {
+  int* x = (int *) malloc(sizeof(int)*n);
+  if (!x) {
     printf("array allocation failed\n");
     exit(-1);
   }
 
-  // initialize to pseudorandom inputs
-  unsigned int seed = 13;
-  for (int i = 0; i < n; ++i) {
-    a[i] = rand_r(&seed);
+  int pivot = a[n / 2];
+  int failures = 0;
+  int nbenches = sizeof(partition_benches) / sizeof(partition_benches[0]);
+  for (int b = 0; b < nbenches; ++b) {
+    double best = 0;
+    bool ok = true;
+    for (int trial = 0; trial < trials; ++trial) {
+      memcpy(x, a, sizeof(int)*n);
+
+      ctimer_t t;
+      ctimer_start(&t);
+      int* middle = partition_benches[b].partition(x, x + n, pivot);
+      ctimer_stop(&t);
+      ctimer_measure(&t);
+
+      double sec = timespec_sec(t.elapsed);
+      if (trial == 0 || sec < best) {
+        best = sec;
+      }
+      for (int* p = x; p < x + n; ++p) {
+        ok &= ((p < middle) == (*p < pivot));
+      }
+    }
+    printf("Partition(%s) = %.9f sec, %.3f GB/s\n", partition_benches[b].name,
+           best, (double)n * sizeof(int) / best / 1e9);
+    failures += !ok;
   }
 
-  ctimer_t t;
-  ctimer_start(&t);
+  free(x);
+  return failures;
+}
 
-  sample_qsort(a, a + n);
+// Input distributions the harness can generate.
+enum input_dist {
+  DIST_RANDOM,      // uniform in [0, RAND_MAX]
+  DIST_SORTED,      // 0, 1, ..., n-1
+  DIST_REVERSE,     // n-1, ..., 1, 0
+  DIST_FEW_UNIQUE,  // uniform in [0, 16)
+  DIST_ORGAN_PIPE   // 0, 1, ..., n/2, ..., 1, 0
+};
 
-  ctimer_stop(&t);
-  ctimer_measure(&t);
+static const char* const input_dist_names[] = {
+  "random", "sorted", "reverse", "few-unique", "organ-pipe"
+};
 
-  // Confirm that a is sorted and that each element contains the index.
-  failFlag = 0;
-  for (int i = 1; i < n; ++i) {
-    if (a[i] < a[i-1]) {
-#ifdef DEBUG
-      printf("Sort failed at location i = %d: a[i-1] = %d, a[i] = %d\n", i, a[i-1], a[i]);
+// Counter-based pseudorandom number generator: the SplitMix64 output for
+// position i of the stream with the given seed.  Every element can be
+// generated independently, so the input can be filled in parallel and is
+// the same for every worker count.
+static inline uint64_t splitmix64(uint64_t seed, uint64_t i) {
+  uint64_t z = seed + (i + 1) * 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// Input i of n drawn from distribution dist.
+static inline int64_t input_key(int64_t i, int64_t n, enum input_dist dist,
+                                uint64_t seed) {
+  uint64_t r = splitmix64(seed, i);
+  switch (dist) {
+  case DIST_RANDOM:     return (int64_t) (r % ((uint64_t) RAND_MAX + 1));
+  case DIST_SORTED:     return i;
+  case DIST_REVERSE:    return n - 1 - i;
+  case DIST_FEW_UNIQUE: return (int64_t) (r % 16);
+  case DIST_ORGAN_PIPE: return (i < n / 2) ? i : n - 1 - i;
+  }
+  return 0;
+}
+
+// Fill a with n inputs drawn from distribution dist, in parallel.
+void fill_input(int* a, int n, enum input_dist dist, uint64_t seed) {
+  cilk_for (int i = 0; i < n; ++i) {
+    a[i] = (int) input_key(i, n, dist, seed);
+  }
+}
+
+// Where main places the array to sort.
+enum placement {
+  PLACE_MALLOC,       // malloc, pages placed by whichever worker fills them
+  PLACE_FIRST_TOUCH,  // fresh mmap pages, touched by a parallel loop first
+  PLACE_INTERLEAVE,   // fresh mmap pages, interleaved over the NUMA nodes
+  PLACE_HUGETLB,      // MAP_HUGETLB pages from the hugetlbfs pool
+  PLACE_THP           // 2 MB-aligned, madvise(MADV_HUGEPAGE) for THP
+};
+
+static const char* const placement_names[] = {
+  "malloc", "first-touch", "interleave", "hugetlb", "thp"
+};
+
+// Huge page size assumed by the hugetlb and thp placements.
+#define HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+// Largest number of NUMA nodes the placement code handles.
+#define MAX_NUMA_NODES 64
+
+// report_placement checks the node of at most this many pages.
+#define PLACEMENT_SAMPLE_PAGES 4096
+
+// Linux memory policy constants, from <numaif.h>, so the harness does
+// not need libnuma.
+#define QSORT_MPOL_INTERLEAVE 3
+#define QSORT_MPOL_F_MEMS_ALLOWED (1 << 2)
+
+static size_t page_size(void) {
+  return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+// Write one int in each page of the bytes at p, in parallel, so that each
+// page is faulted in by some worker and placed on that worker's node
+// under the default first-touch policy.
+static void touch_pages(void* p, size_t bytes) {
+  size_t ps = page_size();
+  cilk_for (size_t off = 0; off < bytes; off += ps) {
+    *(volatile int *) ((char *) p + off) = 0;
+  }
+}
+
+// Bytes to map for n ints with placement how.
+static size_t placement_bytes(size_t n, enum placement how) {
+  size_t align = (how == PLACE_HUGETLB || how == PLACE_THP)
+    ? HUGE_PAGE_SIZE : page_size();
+  return (sizeof(int)*n + align - 1) / align * align;
+}
+
+// Allocate room for n ints with placement how.  Returns NULL on failure.
+int* alloc_array(size_t n, enum placement how) {
+  size_t bytes = placement_bytes(n, how);
+  void* p = NULL;
+  switch (how) {
+  case PLACE_MALLOC:
+    return (int *) malloc(sizeof(int)*n);
+  case PLACE_THP:
+    p = aligned_alloc(HUGE_PAGE_SIZE, bytes);
+#ifdef MADV_HUGEPAGE
+    if (p && madvise(p, bytes, MADV_HUGEPAGE) != 0) {
+      perror("madvise(MADV_HUGEPAGE)");
+    }
 #endif
-      failFlag = 1;
+    return (int *) p;
+  case PLACE_HUGETLB:
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#else
+    p = MAP_FAILED;
+#endif
+    return (p == MAP_FAILED) ? NULL : (int *) p;
+  case PLACE_FIRST_TOUCH:
+  case PLACE_INTERLEAVE:
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      return NULL;
     }
+#ifdef SYS_mbind
+    if (how == PLACE_INTERLEAVE) {
+      unsigned long nodes[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+      memset(nodes, 0, sizeof(nodes));
+      if (syscall(SYS_get_mempolicy, NULL, nodes, MAX_NUMA_NODES, NULL,
+                  QSORT_MPOL_F_MEMS_ALLOWED) != 0
+          || syscall(SYS_mbind, p, bytes, QSORT_MPOL_INTERLEAVE, nodes,
+                     MAX_NUMA_NODES, 0) != 0) {
+        perror("mbind(MPOL_INTERLEAVE)");
+      }
+    }
+#endif
+    touch_pages(p, bytes);
+    return (int *) p;
   }
-  if (failFlag == 1) {
-    ++failCount;
-  }
+  return NULL;
+}
 
-  if (failCount == 0) {
-    printf("All sorts succeeded\n");
-  } else {
-    printf("%d sorts failed\n", failCount);
+// Free an array of n ints allocated by alloc_array with placement how.
+void free_array(int* a, size_t n, enum placement how) {
+  if (how == PLACE_MALLOC || how == PLACE_THP) {
+    free(a);
+  } else if (a) {
+    munmap(a, placement_bytes(n, how));
   }
+}
 
-  ctimer_print(t, "sample_qsort");
+// Print how the pages of the n ints at a are spread over the NUMA nodes,
+// from the node of up to PLACEMENT_SAMPLE_PAGES evenly spaced pages.
+void report_placement(FILE* out, const int* a, size_t n, enum placement how) {
+  fprintf(out, "Placement(%s) =", placement_names[how]);
+#ifdef SYS_move_pages
+  size_t ps = page_size();
+  size_t npages = (sizeof(int)*n + ps - 1) / ps;
+  size_t k = npages < PLACEMENT_SAMPLE_PAGES ? npages : PLACEMENT_SAMPLE_PAGES;
+  void* pages[PLACEMENT_SAMPLE_PAGES];
+  int status[PLACEMENT_SAMPLE_PAGES];
+  uintptr_t base = (uintptr_t) a & ~(uintptr_t) (ps - 1);
+  for (size_t i = 0; i < k; ++i) {
+    pages[i] = (void *) (base + (i * npages / k) * ps);
+  }
+  // with no target nodes, move_pages only reports where each page is
+  if (syscall(SYS_move_pages, 0, k, pages, NULL, status, 0) == 0) {
+    size_t counts[MAX_NUMA_NODES] = {0};
+    size_t unknown = 0;
+    for (size_t i = 0; i < k; ++i) {
+      if (status[i] >= 0 && status[i] < MAX_NUMA_NODES) {
+        counts[status[i]]++;
+      } else {
+        unknown++;
+      }
+    }
+    fprintf(out, " %zu pages sampled:", k);
+    for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+      if (counts[node] > 0) {
+        fprintf(out, " node %d %.1f%%", node, 100.0 * counts[node] / k);
+      }
+    }
+    if (unknown > 0) {
+      fprintf(out, " unknown %.1f%%", 100.0 * unknown / k);
+    }
+    fprintf(out, "\n");
+    return;
+  }
+#endif
+  fprintf(out, " node of pages unavailable\n");
+}
+
+// Number of elements each block of count_unsorted checks.
+#define VERIFY_BLOCK 4096
+
+void zero_long(void* view) {
+  *(long *) view = 0;
+}
+
+void add_long(void* left, void* right) {
+  *(long *) left += *(long *) right;
+}
+
+static int64_t unsorted_block(ptrdiff_t lo, ptrdiff_t hi, void* ctx) {
+  const int* a = (const int *) ctx;
+  int64_t local = 0;
+  for (ptrdiff_t i = (lo == 0) ? 1 : lo; i < hi; ++i) {
+    if (a[i] < a[i-1]) {
+#ifdef DEBUG
+      printf("Sort failed at location i = %td: a[i-1] = %d, a[i] = %d\n", i, a[i-1], a[i]);
+#endif
+      ++local;
+    }
+  }
+  return local;
+}
+
+// Return the number of positions i where a[i] < a[i-1], counted in
+// parallel by blocks of VERIFY_BLOCK positions.
+long count_unsorted(const int* a, int n) {
+  return pprim_reduce_blocks(n, VERIFY_BLOCK, unsorted_block, (void *) a);
+}
+
+// Default size of the chunks external_sort sorts in memory, in MiB.
+#define EXTERNAL_CHUNK_MB 256
+
+// Bytes per block of the copies and writes of external_sort.
+#define EXTERNAL_IO_BLOCK ((size_t) 1 << 20)
+
+// external_sort samples this many keys from each run to split the merge.
+#define EXTERNAL_SAMPLES_PER_RUN 64
+
+// external_sort splits the merge into this many tasks per worker.
+#define EXTERNAL_MERGE_SLACK 4
+
+// Key i of the keys of size bytes (4 or 8) at base.
+static inline int64_t ext_key(const void* base, size_t size, ptrdiff_t i) {
+  return (size == 4) ? ((const int32_t *) base)[i]
+                     : ((const int64_t *) base)[i];
+}
+
+// Write all bytes of buf to fd at offset.  Returns false on error.
+static bool pwrite_all(int fd, const void* buf, size_t bytes, off_t offset) {
+  const char* p = (const char *) buf;
+  while (bytes > 0) {
+    ssize_t w = pwrite(fd, p, bytes, offset);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += w;
+    bytes -= w;
+    offset += w;
+  }
+  return true;
+}
+
+// memcpy in EXTERNAL_IO_BLOCK blocks in parallel, so that the page faults of
+// a mapped source are taken by many workers at once.
+static void parallel_copy(void* dst, const void* src, size_t bytes) {
+  size_t nblocks = (bytes + EXTERNAL_IO_BLOCK - 1) / EXTERNAL_IO_BLOCK;
+  cilk_for (size_t b = 0; b < nblocks; ++b) {
+    size_t off = b * EXTERNAL_IO_BLOCK;
+    size_t len = (bytes - off < EXTERNAL_IO_BLOCK) ? bytes - off
+                                                   : EXTERNAL_IO_BLOCK;
+    memcpy((char *) dst + off, (const char *) src + off, len);
+  }
+}
+
+// Sort the n keys of size bytes at buf: 32-bit keys with sample_qsort,
+// 64-bit keys with the psort.h specialization of the same algorithm.
+static void sort_keys(void* buf, ptrdiff_t n, size_t size) {
+  if (size == 4) {
+    sample_qsort((int *) buf, (int *) buf + n);
+  } else {
+    psort_i64_sort((int64_t *) buf, (int64_t *) buf + n);
+  }
+}
+
+// The I/O that external_sort overlaps with sorting a chunk: write the
+// previous, sorted, chunk from buf to the run file, then load the next
+// chunk of the input into buf.  Either may be empty.
+static bool ext_chunk_io(int runFd, void* buf, size_t sortedBytes,
+                         off_t sortedOff, const char* next, size_t nextBytes) {
+  if (sortedBytes > 0 && !pwrite_all(runFd, buf, sortedBytes, sortedOff)) {
+    return false;
+  }
+  if (nextBytes > 0) {
+    parallel_copy(buf, next, nextBytes);
+  }
+  return true;
+}
+
+// Position of a run in the k-way merge.
+typedef struct {
+  int64_t key;        // key at pos
+  ptrdiff_t pos;      // next key of the run
+  ptrdiff_t end;      // end of the run's part of the merge
+} ext_cursor;
+
+// Restore the order of the min-heap of k cursors below position i.
+static void ext_sift_down(ext_cursor* heap, int k, int i) {
+  ext_cursor top = heap[i];
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= k) {
+      break;
+    }
+    if (c + 1 < k && heap[c + 1].key < heap[c].key) {
+      ++c;
+    }
+    if (top.key <= heap[c].key) {
+      break;
+    }
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = top;
+}
+
+// Merge the parts [lo[r], hi[r]) of the nruns sorted runs in keys and
+// write the result to fd at key offset outPos.  Keys are gathered in two
+// EXTERNAL_IO_BLOCK buffers: while one is being written, the merge fills
+// the other.  Returns false on a write error.
+static bool ext_merge_segment(const char* keys, size_t size, int nruns,
+                              const ptrdiff_t* lo, const ptrdiff_t* hi,
+                              int fd, ptrdiff_t outPos) {
+  ext_cursor* heap = (ext_cursor *) malloc(sizeof(ext_cursor)*nruns);
+  char* bufs = (char *) malloc(2 * EXTERNAL_IO_BLOCK);
+  if (!heap || !bufs) {
+    free(heap);
+    free(bufs);
+    return false;
+  }
+
+  int k = 0;
+  for (int r = 0; r < nruns; ++r) {
+    if (lo[r] < hi[r]) {
+      heap[k].key = ext_key(keys, size, lo[r]);
+      heap[k].pos = lo[r];
+      heap[k].end = hi[r];
+      ++k;
+    }
+  }
+  for (int i = k / 2 - 1; i >= 0; --i) {
+    ext_sift_down(heap, k, i);
+  }
+
+  const size_t cap = EXTERNAL_IO_BLOCK / size;
+  char* buf = bufs;
+  size_t fill = 0;
+  bool written = true;
+  bool ok = true;
+  off_t offset = (off_t) outPos * size;
+  while (k > 0) {
+    memcpy(buf + fill * size, keys + heap[0].pos * size, size);
+    if (++heap[0].pos < heap[0].end) {
+      heap[0].key = ext_key(keys, size, heap[0].pos);
+    } else {
+      heap[0] = heap[--k];
+    }
+    ext_sift_down(heap, k, 0);
+
+    if (++fill == cap) {
+      // the write of the other buffer must finish before it is refilled
+      cilk_sync;
+      ok &= written;
+      written = cilk_spawn pwrite_all(fd, buf, fill * size, offset);
+      offset += fill * size;
+      buf = (buf == bufs) ? bufs + EXTERNAL_IO_BLOCK : bufs;
+      fill = 0;
+    }
+  }
+  cilk_sync;
+  ok &= written && pwrite_all(fd, buf, fill * size, offset);
+
+  free(heap);
+  free(bufs);
+  return ok;
+}
+
+typedef struct {
+  const char* keys;
+  size_t size;
+} ext_unsorted_ctx;
+
+static int64_t ext_unsorted_block(ptrdiff_t lo, ptrdiff_t hi, void* ctx) {
+  const ext_unsorted_ctx* k = (const ext_unsorted_ctx *) ctx;
+  int64_t local = 0;
+  for (ptrdiff_t i = (lo == 0) ? 1 : lo; i < hi; ++i) {
+    local += ext_key(k->keys, k->size, i) < ext_key(k->keys, k->size, i - 1);
+  }
+  return local;
+}
+
+// Count the keys of size bytes at keys[0..n) that are less than the key
+// before them (cf. count_unsorted).
+static long ext_count_unsorted(const char* keys, ptrdiff_t n, size_t size) {
+  ext_unsorted_ctx k = {keys, size};
+  return pprim_reduce_blocks(n, VERIFY_BLOCK, ext_unsorted_block, &k);
+}
+
+// Sorts the file of keys of size bytes (4 or 8, native byte order) at
+// inPath into outPath, with chunkBytes of memory for the sort.
+//
+// Phase 1 forms runs: the input is mapped, and each chunk is copied into
+// one of two buffers, sorted in memory and written to a temporary run file
+// (unlinked, next to the output).  While one buffer is sorted, the other
+// writes out the previous chunk and loads the next one, so the I/O
+// overlaps with the sort.  An input that fits in one chunk is written
+// straight to the output.
+//
+// Phase 2 merges the runs from a mapping of the run file.  Keys sampled
+// from every run give splitters that cut each run, by binary search, into
+// EXTERNAL_MERGE_SLACK parts per worker, and the parts between two
+// splitters are merged into their place in the output in parallel.
+//
+// Prints the time of each phase and returns the number of keys out of
+// order in the output, or -1 after an error.
+long external_sort(const char* inPath, const char* outPath, size_t size,
+                   size_t chunkBytes, FILE* info) {
+  long result = -1;
+  int inFd = -1, outFd = -1, runFd = -1;
+  const char* in = MAP_FAILED;
+  const char* runs = MAP_FAILED;
+  char* bufs[2] = {NULL, NULL};
+  char* runPath = NULL;
+  ptrdiff_t* bounds = NULL;
+  int64_t* sample = NULL;
+  struct stat st;
+
+  inFd = open(inPath, O_RDONLY);
+  if (inFd < 0 || fstat(inFd, &st) != 0) {
+    perror(inPath);
+    goto done;
+  }
+  size_t bytes = (size_t) st.st_size;
+  if (bytes % size != 0) {
+    fprintf(stderr, "%s: size is not a multiple of %zu-byte keys\n", inPath,
+            size);
+    goto done;
+  }
+  ptrdiff_t n = bytes / size;
+  ptrdiff_t chunkKeys = chunkBytes / size;
+  if (chunkKeys < 1) {
+    chunkKeys = 1;
+  }
+  int nruns = (n + chunkKeys - 1) / chunkKeys;
+  fprintf(info, "External sort of %ld %zu-bit keys in %d run(s) of up to "
+          "%ld keys\n", (long) n, 8 * size, nruns, (long) chunkKeys);
+
+  outFd = open(outPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (outFd < 0 || ftruncate(outFd, bytes) != 0) {
+    perror(outPath);
+    goto done;
+  }
+  if (n == 0) {
+    result = 0;
+    goto done;
+  }
+  in = (const char *) mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, inFd, 0);
+  if (in == MAP_FAILED) {
+    perror(inPath);
+    goto done;
+  }
+  madvise((void *) in, bytes, MADV_SEQUENTIAL);
+
+  runFd = outFd;
+  if (nruns > 1) {
+    size_t pathBytes = strlen(outPath) + sizeof(".runs");
+    runPath = (char *) malloc(pathBytes);
+    if (!runPath) {
+      fprintf(stderr, "path allocation failed\n");
+      goto done;
+    }
+    snprintf(runPath, pathBytes, "%s.runs", outPath);
+    runFd = open(runPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (runFd < 0 || unlink(runPath) != 0 || ftruncate(runFd, bytes) != 0) {
+      perror(runPath);
+      goto done;
+    }
+  }
+
+  // phase 1: sorted runs
+  size_t bufBytes = (size_t) (n < chunkKeys ? n : chunkKeys) * size;
+  bufs[0] = (char *) malloc(bufBytes);
+  bufs[1] = (nruns > 1) ? (char *) malloc(bufBytes) : NULL;
+  if (!bufs[0] || (nruns > 1 && !bufs[1])) {
+    fprintf(stderr, "chunk allocation failed\n");
+    goto done;
+  }
+
+  ctimer_t t;
+  ctimer_start(&t);
+  bool ok = true;
+  parallel_copy(bufs[0], in, bufBytes);
+  for (int c = 0; c < nruns && ok; ++c) {
+    char* cur = bufs[c % 2];
+    char* other = bufs[(c + 1) % 2];
+    ptrdiff_t lo = (ptrdiff_t) c * chunkKeys;
+    ptrdiff_t len = (n - lo < chunkKeys) ? n - lo : chunkKeys;
+    ptrdiff_t nextLo = lo + len;
+    ptrdiff_t nextLen = (n - nextLo < chunkKeys) ? n - nextLo : chunkKeys;
+    cilk_scope {
+      ok = cilk_spawn ext_chunk_io(runFd, other,
+                                   c > 0 ? chunkKeys * size : 0,
+                                   (off_t) (lo - chunkKeys) * size,
+                                   in + nextLo * size, nextLen * size);
+      sort_keys(cur, len, size);
+    }
+    if (c == nruns - 1) {
+      ok = ok && pwrite_all(runFd, cur, len * size, (off_t) lo * size);
+    }
+  }
+  ctimer_stop(&t);
+  ctimer_measure(&t);
+  ctimer_print(t, "external_sort:runs");
+  if (!ok) {
+    perror(runPath ? runPath : outPath);
+    goto done;
+  }
+
+  // phase 2: parallel k-way merge
+  if (nruns > 1) {
+    ctimer_start(&t);
+    runs = (const char *) mmap(NULL, bytes, PROT_READ, MAP_SHARED, runFd, 0);
+    if (runs == MAP_FAILED) {
+      perror(runPath);
+      goto done;
+    }
+    madvise((void *) runs, bytes, MADV_SEQUENTIAL);
+
+    int nsegs = EXTERNAL_MERGE_SLACK * __cilkrts_get_nworkers();
+    int nsamples = EXTERNAL_SAMPLES_PER_RUN * nruns;
+    sample = (int64_t *) malloc(sizeof(int64_t)*nsamples);
+    bounds = (ptrdiff_t *) malloc(sizeof(ptrdiff_t)*(nsegs + 1)*nruns);
+    if (!sample || !bounds) {
+      fprintf(stderr, "merge allocation failed\n");
+      goto done;
+    }
+
+    // splitters from a sample of every run
+    for (int r = 0; r < nruns; ++r) {
+      ptrdiff_t lo = (ptrdiff_t) r * chunkKeys;
+      ptrdiff_t len = (n - lo < chunkKeys) ? n - lo : chunkKeys;
+      for (int s = 0; s < EXTERNAL_SAMPLES_PER_RUN; ++s) {
+        sample[r * EXTERNAL_SAMPLES_PER_RUN + s] =
+          ext_key(runs, size, lo + s * len / EXTERNAL_SAMPLES_PER_RUN);
+      }
+    }
+    psort_i64_sort(sample, sample + nsamples);
+
+    // bounds[j * nruns + r] is where segment j starts in run r: the first
+    // key of the run not less than splitter j
+    cilk_for (int j = 0; j <= nsegs; ++j) {
+      for (int r = 0; r < nruns; ++r) {
+        ptrdiff_t lo = (ptrdiff_t) r * chunkKeys;
+        ptrdiff_t hi = (n - lo < chunkKeys) ? n : lo + chunkKeys;
+        ptrdiff_t pos = lo;
+        if (j == nsegs) {
+          pos = hi;
+        } else if (j > 0) {
+          int64_t splitter = sample[(ptrdiff_t) j * nsamples / nsegs];
+          while (lo < hi) {
+            ptrdiff_t mid = lo + (hi - lo) / 2;
+            if (ext_key(runs, size, mid) < splitter) {
+              lo = mid + 1;
+            } else {
+              hi = mid;
+            }
+          }
+          pos = lo;
+        }
+        bounds[(ptrdiff_t) j * nruns + r] = pos;
+      }
+    }
+
+    long cilk_reducer(zero_long, add_long) failures = 0;
+    cilk_for (int j = 0; j < nsegs; ++j) {
+      const ptrdiff_t* lo = bounds + (ptrdiff_t) j * nruns;
+      const ptrdiff_t* hi = lo + nruns;
+      ptrdiff_t outPos = 0;
+      for (int r = 0; r < nruns; ++r) {
+        outPos += lo[r] - (ptrdiff_t) r * chunkKeys;
+      }
+      if (!ext_merge_segment(runs, size, nruns, lo, hi, outFd, outPos)) {
+        failures += 1;
+      }
+    }
+    ctimer_stop(&t);
+    ctimer_measure(&t);
+    ctimer_print(t, "external_sort:merge");
+    if (failures > 0) {
+      perror(outPath);
+      goto done;
+    }
+  }
+
+  // check the output
+  const char* out =
+    (const char *) mmap(NULL, bytes, PROT_READ, MAP_SHARED, outFd, 0);
+  if (out == MAP_FAILED) {
+    perror(outPath);
+    goto done;
+  }
+  result = ext_count_unsorted(out, n, size);
+  munmap((void *) out, bytes);
+
+done:
+  if (runs != MAP_FAILED) {
+    munmap((void *) runs, bytes);
+  }
+  if (in != MAP_FAILED) {
+    munmap((void *) in, bytes);
+  }
+  if (runFd >= 0 && runFd != outFd) {
+    close(runFd);
+  }
+  if (outFd >= 0) {
+    close(outFd);
+  }
+  if (inFd >= 0) {
+    close(inFd);
+  }
+  free(bufs[0]);
+  free(bufs[1]);
+  free(runPath);
+  free(bounds);
+  free(sample);
+  return result;
+}
+
+// Write n keys of size bytes (4 or 8) from distribution dist to the file
+// at path, generating each EXTERNAL_IO_BLOCK block in parallel.  Random
+// 64-bit keys use all 64 bits.  Returns false on error.
+bool write_input_file(const char* path, int64_t n, size_t size,
+                      enum input_dist dist, uint64_t seed) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  char* buf = (char *) malloc(EXTERNAL_IO_BLOCK);
+  bool ok = (fd >= 0 && buf);
+  const int64_t blockKeys = EXTERNAL_IO_BLOCK / size;
+  for (int64_t lo = 0; ok && lo < n; lo += blockKeys) {
+    int64_t len = (n - lo < blockKeys) ? n - lo : blockKeys;
+    cilk_for (int64_t i = 0; i < len; ++i) {
+      int64_t key = (size == 8 && dist == DIST_RANDOM)
+        ? (int64_t) splitmix64(seed, lo + i)
+        : input_key(lo + i, n, dist, seed);
+      if (size == 4) {
+        ((int32_t *) buf)[i] = (int32_t) key;
+      } else {
+        ((int64_t *) buf)[i] = key;
+      }
+    }
+    ok = pwrite_all(fd, buf, len * size, (off_t) lo * size);
+  }
+  if (!ok) {
+    perror(path);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  free(buf);
+  return ok;
+}
+
+// Summary statistics of the times of a series of trials, in seconds.
+typedef struct {
+  int trials;
+  double min;
+  double median;
+  double mean;
+  double stddev;  // sample standard deviation
+  double p95;     // 95th percentile (nearest rank)
+} trial_stats;
+
+static int compare_doubles(const void* x, const void* y) {
+  double a = *(const double *) x, b = *(const double *) y;
+  return (a > b) - (a < b);
+}
+
+// Summarize the times of k >= 1 trials.
+trial_stats summarize_trials(const double* times, int k) {
+  double* sorted = (double *) malloc(sizeof(double)*k);
+  if (!sorted) {
+    printf("array allocation failed\n");
+    exit(-1);
+  }
+  memcpy(sorted, times, sizeof(double)*k);
+  qsort(sorted, k, sizeof(double), compare_doubles);
+
+  trial_stats s;
+  s.trials = k;
+  s.min = sorted[0];
+  s.median = (k % 2) ? sorted[k / 2] : (sorted[k / 2 - 1] + sorted[k / 2]) / 2;
+  s.p95 = sorted[(95 * k + 99) / 100 - 1];
+  double sum = 0.0;
+  for (int i = 0; i < k; ++i) {
+    sum += times[i];
+  }
+  s.mean = sum / k;
+  double sq = 0.0;
+  for (int i = 0; i < k; ++i) {
+    sq += (times[i] - s.mean) * (times[i] - s.mean);
+  }
+  s.stddev = (k > 1) ? sqrt(sq / (k - 1)) : 0.0;
+
+  free(sorted);
+  return s;
+}
+
+// Output formats of the harness.
+enum output_format {
+  FORMAT_TEXT,  // human-readable lines
+  FORMAT_CSV,   // header plus one summary row
+  FORMAT_JSON   // one summary object, including all trial times
+};
+
+static const char* const output_format_names[] = {"text", "csv", "json"};
+
+#ifdef CTIMER_PERF
+// Add the counts of one trial into sum, which starts out zeroed.
+static void add_perf_counts(ctimer_perf_t* sum, const ctimer_perf_t* p) {
+  if (sum->nevents == 0 && sum->error == 0) {
+    sum->nevents = p->nevents;
+    memcpy(sum->event, p->event, sizeof(sum->event));
+  }
+  if (sum->error == 0) {
+    sum->error = p->error;
+  }
+  for (int e = 0; e < p->nevents; ++e) {
+    sum->count[e] += p->count[e];
+  }
+}
+
+// Instructions per cycle of p, or -1 unless it counted both.
+static double perf_ipc(const ctimer_perf_t* p) {
+  double cycles = ctimer_perf_count(p, "cycles");
+  double instructions = ctimer_perf_count(p, "instructions");
+  return (cycles > 0 && instructions >= 0) ? instructions / cycles : -1;
+}
+
+// The counter columns of the -f csv header and row: one per event, summed
+// over the trials, and ipc; the values are empty if the counters could not
+// be read.
+static void print_perf_csv_header(const ctimer_perf_t* p) {
+  for (int e = 0; e < p->nevents; ++e) {
+    printf(",%s", ctimer_perf_name(p, e));
+  }
+  printf(",ipc");
+}
+
+static void print_perf_csv(const ctimer_perf_t* p) {
+  for (int e = 0; e < p->nevents; ++e) {
+    if (p->error == 0) {
+      printf(",%llu", (unsigned long long) p->count[e]);
+    } else {
+      printf(",");
+    }
+  }
+  double ipc = perf_ipc(p);
+  if (ipc >= 0) {
+    printf(",%.4f", ipc);
+  } else {
+    printf(",");
+  }
+}
+
+// The "counters" member of the -f json object, summed over the trials, or
+// null if the counters could not be read.
+static void print_perf_json(const ctimer_perf_t* p) {
+  if (p->error != 0) {
+    printf(" \"counters\": null,\n");
+    return;
+  }
+  printf(" \"counters\": {");
+  for (int e = 0; e < p->nevents; ++e) {
+    printf("%s\"%s\": %llu", e > 0 ? ", " : "", ctimer_perf_name(p, e),
+           (unsigned long long) p->count[e]);
+  }
+  double ipc = perf_ipc(p);
+  if (ipc >= 0) {
+    printf("%s\"ipc\": %.4f", p->nevents > 0 ? ", " : "", ipc);
+  }
+  printf("},\n");
+}
+#endif
+
+// Rank the nth and topk entries of sort_algos select: nth places the
+// element of rank select_k, and topk sorts the select_k smallest elements.
+// 0, or a rank out of range, selects the median.
+static ptrdiff_t select_k = 0;
+
+static ptrdiff_t select_rank(ptrdiff_t n) {
+  return (select_k > 0 && select_k < n) ? select_k : n / 2;
+}
+
+void nth_element_rank(int* begin, int* end) {
+  nth_element(begin, begin + select_rank(end - begin), end);
+}
+
+void partial_sort_rank(int* begin, int* end) {
+  partial_sort(begin, begin + select_rank(end - begin), end);
+}
+
+typedef struct {
+  const int* a;
+  int k;
+} misplaced_ctx;
+
+static int64_t misplaced_block(ptrdiff_t lo, ptrdiff_t hi, void* ctx) {
+  const int* a = ((const misplaced_ctx *) ctx)->a;
+  int k = ((const misplaced_ctx *) ctx)->k;
+  int64_t local = 0;
+  for (ptrdiff_t i = lo; i < hi; ++i) {
+    local += (i < k) ? (a[i] > a[k]) : (a[i] < a[k]);
+  }
+  return local;
+}
+
+// Count the elements of a[0..n) that are on the wrong side of a[k]: greater
+// ones before it and smaller ones after it.
+static long count_misplaced(const int* a, int n, int k) {
+  misplaced_ctx c = {a, k};
+  return pprim_reduce_blocks(n, VERIFY_BLOCK, misplaced_block, &c);
+}
+
+// Checks of the output of nth_element_rank and partial_sort_rank, in the
+// manner of count_unsorted.
+long count_misselected(const int* a, int n) {
+  return count_misplaced(a, n, select_rank(n));
+}
+
+long count_unsorted_prefix(const int* a, int n) {
+  int k = select_rank(n);
+  return count_unsorted(a, k) + ((k < n) ? count_misplaced(a, n, k) : 0);
+}
+
+// The batch algorithms sort the array as independent segments whose sizes
+// are drawn log-uniformly from [batch_min, batch_max]: batch with
+// sort_segments, and batch-loop with sample_qsort on one segment after the
+// other, as a caller without a batched API would.
+static ptrdiff_t batch_min = 10;
+static ptrdiff_t batch_max = 10000;
+static ptrdiff_t* batch_offsets = NULL;
+static ptrdiff_t batch_segments = 0;
+
+// Cut n elements into segments for the batch algorithms; the last segment
+// takes what is left.  Returns false if the offsets cannot be allocated.
+static bool make_batch(ptrdiff_t n, uint64_t seed) {
+  free(batch_offsets);
+  batch_offsets = (ptrdiff_t *) malloc(sizeof(ptrdiff_t)*(n / batch_min + 2));
+  if (!batch_offsets) {
+    return false;
+  }
+  double range = log((double) batch_max / batch_min);
+  ptrdiff_t nsegs = 0;
+  ptrdiff_t offset = 0;
+  batch_offsets[0] = 0;
+  while (offset < n) {
+    double u = (splitmix64(seed, nsegs) >> 11) * 0x1.0p-53;
+    ptrdiff_t size = (ptrdiff_t) (batch_min * exp(u * range) + 0.5);
+    size = (size < batch_min) ? batch_min
+         : (size > batch_max) ? batch_max : size;
+    offset = (size < n - offset) ? offset + size : n;
+    batch_offsets[++nsegs] = offset;
+  }
+  batch_segments = nsegs;
+  return true;
+}
+
+void sort_batch(int* begin, int* end) {
+  (void) end;
+  sort_segments(begin, batch_offsets, batch_segments);
+}
+
+void sort_batch_loop(int* begin, int* end) {
+  (void) end;
+  for (ptrdiff_t i = 0; i < batch_segments; ++i) {
+    sample_qsort(begin + batch_offsets[i], begin + batch_offsets[i+1]);
+  }
+}
+
+static int64_t segments_unsorted_block(ptrdiff_t lo, ptrdiff_t hi,
+                                       void* ctx) {
+  const int* a = (const int *) ctx;
+  // largest segment s with batch_offsets[s] <= lo
+  ptrdiff_t s = 0, t = batch_segments;
+  while (t - s > 1) {
+    ptrdiff_t m = s + (t - s) / 2;
+    if (batch_offsets[m] <= lo) {
+      s = m;
+    } else {
+      t = m;
+    }
+  }
+  int64_t local = 0;
+  for (ptrdiff_t i = lo; i < hi; ++i) {
+    if (i == batch_offsets[s+1]) {
+      ++s;
+    }
+    local += (i > batch_offsets[s]) && (a[i] < a[i-1]);
+  }
+  return local;
+}
+
+// Check of the batch algorithms: count_unsorted within each segment.
+long count_unsorted_segments(const int* a, int n) {
+  return pprim_reduce_blocks(n, VERIFY_BLOCK, segments_unsorted_block,
+                             (void *) a);
+}
+
+// psort() on ints, to measure the cost of the generic comparator-based
+// interface against the inlined psort_int_sort specialization.
+void psort_ints(int* begin, int* end) {
+  psort(begin, end - begin, sizeof(int), compare_ints);
+}
+
+// Sorting algorithms the harness can run.
+typedef struct {
+  const char* name;             // name for -a/--algo
+  const char* label;            // label for the timing output
+  void (*sort)(int*, int*);     // sorts the range [begin, end)
+  long (*check)(const int*, int);  // counts errors; NULL for count_unsorted
+} sort_algo;
+
+static const sort_algo sort_algos[] = {
+  {"qsort", "sample_qsort", sample_qsort},
+  {"radix", "radix_sort",   radix_sort},
+  {"merge", "merge_sort",   merge_sort},
+  {"nth",   "nth_element",  nth_element_rank, count_misselected},
+  {"topk",  "partial_sort", partial_sort_rank, count_unsorted_prefix},
+  {"psort", "psort_int_sort", psort_int_sort},
+  {"psort-cmp", "psort", psort_ints},
+  {"batch", "sort_segments", sort_batch, count_unsorted_segments},
+  {"batch-loop", "sample_qsort_loop", sort_batch_loop,
+   count_unsorted_segments},
+};
+
+#define NUM_SORT_ALGOS ((int) (sizeof(sort_algos) / sizeof(sort_algos[0])))
+
+// Return the index of name in names[0..count), or -1 if it is not there.
+int lookup_name(const char* name, const char* const* names, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [<options>] [<n> [<trials>]]\n", prog);
+  fprintf(stderr, "  -a, --algo <a>   sorting algorithm:");
+  for (int i = 0; i < NUM_SORT_ALGOS; ++i) {
+    fprintf(stderr, "%s %s", i > 0 ? "," : "", sort_algos[i].name);
+  }
+  fprintf(stderr, " (default %s)\n", sort_algos[0].name);
+  fprintf(stderr, "  -g, --grain <g>  sort ranges shorter than <g> serially;\n"
+                  "                   0 auto-tunes (default %d)\n",
+          QSORT_GRAINSIZE);
+  fprintf(stderr, "  -p, --pivot <r>  pivot rule: last, median3, ninther "
+                  "(default ninther)\n");
+  fprintf(stderr, "  -m, --partition <m>\n"
+                  "                   keys equal to the pivot: two-way, "
+                  "three-way, auto\n"
+                  "                   (default auto)\n");
+  fprintf(stderr, "  -x, --kernel <k> serial partition kernel: scalar, "
+                  "simd (%s), block\n"
+                  "                   (default simd)\n", SIMD_PARTITION_ISA);
+  fprintf(stderr, "  -k, --check-partition\n"
+                  "                   check simd_partition and "
+                  "block_partition against\n"
+                  "                   partition()\n");
+  fprintf(stderr, "  -b, --partition-bench\n"
+                  "                   time the partition kernels alone "
+                  "instead of sorting\n");
+  fprintf(stderr, "  -d, --dist <d>   input: random, sorted, reverse, "
+                  "few-unique, organ-pipe\n"
+                  "                   (default random)\n");
+  fprintf(stderr, "  -w, --warmup <w> untimed warm-up runs before the trials "
+                  "(default 0)\n");
+  fprintf(stderr, "  -f, --format <f> output: text, csv, json "
+                  "(default text)\n");
+  fprintf(stderr, "  -M, --memory <p> array placement: malloc, first-touch, "
+                  "interleave,\n"
+                  "                   hugetlb, thp (default malloc)\n");
+  fprintf(stderr, "  -s, --select <k> with -a nth, place the element of "
+                  "rank <k>; with\n"
+                  "                   -a topk, sort the <k> smallest "
+                  "(default n/2)\n");
+  fprintf(stderr, "  -B, --batch <min>[:<max>]\n"
+                  "                   with -a batch and -a batch-loop, "
+                  "segment sizes\n"
+                  "                   (log-uniform, default %td:%td)\n",
+          batch_min, batch_max);
+  fprintf(stderr, "  -i, --input <f>  sort the keys in file <f> out of core "
+                  "into -o <f>\n");
+  fprintf(stderr, "  -o, --output <f> output file of -i\n");
+  fprintf(stderr, "  -W, --write-input <f>\n"
+                  "                   write <n> keys from -d to file <f> "
+                  "and exit\n");
+  fprintf(stderr, "  -K, --key-bits <b>\n"
+                  "                   key size of -i and -W files: 32, 64 "
+                  "(default 32)\n");
+  fprintf(stderr, "  -c, --chunk <c>  memory for -i chunk sorts, in MiB "
+                  "(default %d)\n", EXTERNAL_CHUNK_MB);
+}
+
+// A simple test harness.  Program takes 2 optional arguments:
+//   First argument specifies the length of the array to sort.
+//   Defaults to 1 million.
+//   Second argument specifies the number of trials to run.
+//   Defaults to 1.
+// Option -g/--grain sets the grain size of sample_qsort; -g 0 auto-tunes it.
+// Options -p/--pivot and -m/--partition select the pivot rule and the
+// partition mode.
+// Option -d/--dist selects the input distribution.
+// Option -x/--kernel selects the serial partition kernel.
+// Option -k/--check-partition first checks simd_partition and
+// block_partition against the scalar partition() on the input.
+// Option -b/--partition-bench times each partition kernel on the input in
+// place of the sorting trials.
+// Option -a/--algo selects the sorting algorithm; the options above only
+// apply to sample_qsort.
+// Option -s/--select sets the rank for the nth and topk algorithms, whose
+// output is checked for a correct selection instead of a full sort.
+// Option -B/--batch sets the segment sizes of the batch and batch-loop
+// algorithms, which also report segments/sec.
+// Each trial and each of the -w/--warmup runs sorts a fresh input with
+// its own seed.  After the trials, their min/median/mean/stddev/p95 time
+// and the median throughput are printed, or emitted as CSV or JSON with
+// -f/--format (other messages then go to stderr).
+// Option -M/--memory selects how the array is allocated and placed on the
+// NUMA nodes; the placement is reported before the trials.
+// Option -i/--input sorts a file of 32- or 64-bit keys (-K/--key-bits)
+// into the -o/--output file with external_sort, using -c/--chunk MiB of
+// memory, instead of running the trials; -W/--write-input writes such a
+// file.
+int main(int argc, char **argv) {
+  int *a = NULL, failCount = 0;
+  int failFlag;
+
+  static const struct option longopts[] = {
+    {"algo",      required_argument, NULL, 'a'},
+    {"grain",     required_argument, NULL, 'g'},
+    {"pivot",     required_argument, NULL, 'p'},
+    {"partition", required_argument, NULL, 'm'},
+    {"dist",      required_argument, NULL, 'd'},
+    {"check-partition", no_argument, NULL, 'k'},
+    {"kernel",    required_argument, NULL, 'x'},
+    {"partition-bench", no_argument, NULL, 'b'},
+    {"warmup",    required_argument, NULL, 'w'},
+    {"format",    required_argument, NULL, 'f'},
+    {"memory",    required_argument, NULL, 'M'},
+    {"input",     required_argument, NULL, 'i'},
+    {"output",    required_argument, NULL, 'o'},
+    {"write-input", required_argument, NULL, 'W'},
+    {"key-bits",  required_argument, NULL, 'K'},
+    {"chunk",     required_argument, NULL, 'c'},
+    {"select",    required_argument, NULL, 's'},
+    {"batch",     required_argument, NULL, 'B'},
+    {"help",      no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  const sort_algo* algo = &sort_algos[0];
+  enum input_dist dist = DIST_RANDOM;
+  bool checkPartition = false;
+  bool benchPartition = false;
+  int warmups = 0;
+  enum output_format format = FORMAT_TEXT;
+  enum placement placement = PLACE_MALLOC;
+  const char* inputPath = NULL;
+  const char* outputPath = NULL;
+  const char* writePath = NULL;
+  int keyBits = 32;
+  long chunkMB = EXTERNAL_CHUNK_MB;
+  int opt, idx;
+  while ((opt = getopt_long(argc, argv, "a:g:p:m:d:kx:bw:f:M:i:o:W:K:c:s:B:h",
+                            longopts, NULL)) != -1) {
+    switch (opt) {
+    case 'a':
+      algo = NULL;
+      for (int i = 0; i < NUM_SORT_ALGOS; ++i) {
+        if (strcmp(optarg, sort_algos[i].name) == 0) {
+          algo = &sort_algos[i];
+        }
+      }
+      if (!algo) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      break;
+    case 'g':
+      grainsize = atol(optarg);
+      break;
+    case 'p':
+      idx = lookup_name(optarg, pivot_rule_names, 3);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      pivot_rule = (enum pivot_rule) idx;
+      break;
+    case 'm':
+      idx = lookup_name(optarg, partition_mode_names, 3);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      partition_mode = (enum partition_mode) idx;
+      break;
+    case 'd':
+      idx = lookup_name(optarg, input_dist_names, 5);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      dist = (enum input_dist) idx;
+      break;
+    case 'k':
+      checkPartition = true;
+      break;
+    case 'x':
+      idx = lookup_name(optarg, partition_kernel_names, 3);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      partition_kernel = (enum partition_kernel) idx;
+      break;
+    case 'b':
+      benchPartition = true;
+      break;
+    case 'w':
+      warmups = atoi(optarg);
+      break;
+    case 'f':
+      idx = lookup_name(optarg, output_format_names, 3);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      format = (enum output_format) idx;
+      break;
+    case 'M':
+      idx = lookup_name(optarg, placement_names, 5);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      placement = (enum placement) idx;
+      break;
+    case 'i':
+      inputPath = optarg;
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    case 'W':
+      writePath = optarg;
+      break;
+    case 'K':
+      keyBits = atoi(optarg);
+      if (keyBits != 32 && keyBits != 64) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      break;
+    case 'c':
+      chunkMB = atol(optarg);
+      break;
+    case 's':
+      select_k = atol(optarg);
+      break;
+    case 'B': {
+      // parse into locals, so that usage() still prints the defaults
+      char* rest;
+      ptrdiff_t lo = strtol(optarg, &rest, 10);
+      ptrdiff_t hi = (*rest == ':') ? strtol(rest + 1, &rest, 10) : lo;
+      if (*rest != '\0' || lo < 1 || hi < lo) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      batch_min = lo;
+      batch_max = hi;
+      break;
+    }
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+    default:
+      usage(argv[0]);
+      exit(-1);
+    }
+  }
+
+  // get number of integers to sort, default 1 million
+  int n = 1000*1000;
+  if (optind < argc) {
+    n = atoi(argv[optind]);
+  }
+  // get number of trials, default 1
+  int trials = 1;
+  if (optind + 1 < argc) {
+    trials = atoi(argv[optind + 1]);
+  }
+
+  // machine-readable output owns stdout
+  FILE* info = (format == FORMAT_TEXT) ? stdout : stderr;
+
+  // file modes: write an input file, or sort one out of core
+  if (writePath) {
+    int64_t keys = (optind < argc) ? strtoll(argv[optind], NULL, 10) : n;
+    fprintf(info, "Writing %lld %d-bit keys (%s input) to %s\n",
+            (long long) keys, keyBits, input_dist_names[dist], writePath);
+    if (keys < 0 || !write_input_file(writePath, keys, keyBits / 8, dist,
+                                      INPUT_SEED)) {
+      exit(-1);
+    }
+    return 0;
+  }
+  if (inputPath) {
+    if (!outputPath || chunkMB < 1) {
+      usage(argv[0]);
+      exit(-1);
+    }
+    instr_t k;
+    instr_start(&k);
+    long unsorted = external_sort(inputPath, outputPath, keyBits / 8,
+                                  (size_t) chunkMB << 20, info);
+    instr_stop(&k);
+    if (unsorted < 0) {
+      exit(-1);
+    }
+    struct stat st;
+    int sized = (stat(outputPath, &st) == 0);
+    instr_print(k, "external_sort",
+                sized ? (double) st.st_size / (keyBits / 8) : 0);
+    if (unsorted == 0) {
+      fprintf(info, "All sorts succeeded\n");
+    } else {
+      fprintf(info, "%ld keys out of order\n", unsorted);
+    }
+    if (sized) {
+      printf("Throughput(external_sort) = %.3f GB/s\n",
+             (double) st.st_size / instr_sec(k) / 1e9);
+    }
+    return unsorted > 0;
+  }
+  if (algo->sort == sample_qsort) {
+    fprintf(info, "Sorting %d integers (%s input, %s pivot, %s partition)\n", n,
+            input_dist_names[dist], pivot_rule_names[pivot_rule],
+            partition_mode_names[partition_mode]);
+  } else {
+    fprintf(info, "Sorting %d integers (%s input, %s)\n", n,
+            input_dist_names[dist], algo->label);
+  }
+
+  // check arguments
+  if (n < 1) {
+    fprintf(stderr, "array length must be positive\n");
+    exit(-1);
+  }
+  if (trials < 1) {
+    fprintf(stderr, "number of trials must be positive\n");
+    exit(-1);
+  }
+  if (warmups < 0) {
+    fprintf(stderr, "number of warm-up runs must be non-negative\n");
+    exit(-1);
+  }
+  if (grainsize < 0) {
+    fprintf(stderr, "grain size must be non-negative\n");
+    exit(-1);
+  }
+
+  // allocate memory for array and trial times
+  a = alloc_array(n, placement);
+  double* times = (double *) malloc(sizeof(double)*trials);
+  if (!a || !times) {
+    fprintf(stderr, "array allocation failed\n");
+    if (placement == PLACE_HUGETLB) {
+      fprintf(stderr,
+              "(hugetlb needs free huge pages, see vm.nr_hugepages)\n");
+    }
+    exit(-1);
+  }
+
+  // initialize to inputs from the chosen distribution
+  fill_input(a, n, dist, INPUT_SEED);
+  report_placement(info, a, n, placement);
+
+  if (checkPartition) {
+    int mismatches = check_partition(a, n, simd_partition);
+    fprintf(info, "simd_partition (%s) %s partition() on %d pivots\n",
+            SIMD_PARTITION_ISA, mismatches ? "DISAGREES with" : "matches",
+            CHECK_PARTITION_PIVOTS);
+    failCount += (mismatches > 0);
+    mismatches = check_partition(a, n, block_partition);
+    fprintf(info, "block_partition %s partition() on %d pivots\n",
+            mismatches ? "DISAGREES with" : "matches", CHECK_PARTITION_PIVOTS);
+    failCount += (mismatches > 0);
+  }
+
+  if (benchPartition) {
+    failCount += bench_partition(a, n, trials);
+    free_array(a, n, placement);
+    free(times);
+    return failCount;
+  }
+
+  if (grainsize == 0 && algo->sort == sample_qsort) {
+    grainsize = autotune_grainsize(a, n);
+    fprintf(info, "Auto-tuned grain size = %ld\n", (long)grainsize);
+  }
+
+  bool batch = (algo->check == count_unsorted_segments);
+  if (batch) {
+    if (!make_batch(n, INPUT_SEED)) {
+      fprintf(stderr, "array allocation failed\n");
+      exit(-1);
+    }
+    fprintf(info, "Batch of %td segments of %td to %td integers\n",
+            batch_segments, batch_min, batch_max);
+  }
+
+  // warm-up runs use the seeds after those of the trials
+  for (int w = 0; w < warmups; ++w) {
+    fill_input(a, n, dist, INPUT_SEED + trials + w);
+    algo->sort(a, a + n);
+  }
+
+#ifdef QSORT_PHASE_TIMES
+  ctimer_sum_reset(&partition_time);
+  ctimer_sum_reset(&base_case_time);
+#endif
+
+#ifdef CTIMER_PERF
+  // counters summed over the trials, for the -f csv and -f json rows
+  ctimer_perf_t perfSum;
+  memset(&perfSum, 0, sizeof(perfSum));
+#endif
+
+  for (int trial = 0; trial < trials; ++trial) {
+    fill_input(a, n, dist, INPUT_SEED + trial);
+
+    instr_t k;
+    instr_start(&k);
+
+    algo->sort(a, a + n);
+
+    instr_stop(&k);
+    times[trial] = instr_sec(k);
+#ifdef CTIMER_PERF
+    add_perf_counts(&perfSum, &k.perf);
+#endif
+
+    // Confirm that a is sorted (or selected).
+    failFlag = ((algo->check ? algo->check(a, n) : count_unsorted(a, n)) > 0);
+    if (failFlag == 1) {
+      ++failCount;
+    }
+
+    if (format == FORMAT_TEXT) {
+      instr_print(k, algo->label, n);
+    }
+  }
+
+  if (failCount == 0) {
+    fprintf(info, "All sorts succeeded\n");
+  } else {
+    fprintf(info, "%d sorts failed\n", failCount);
+  }
+
+  trial_stats st = summarize_trials(times, trials);
+  double elemsPerSec = n / st.median;
+  double gbPerSec = (double)n * sizeof(int) / st.median / 1e9;
+  switch (format) {
+  case FORMAT_TEXT:
+    if (trials > 1) {
+      printf("Stats(%s) = %d trials: min %.9f, median %.9f, mean %.9f, "
+             "stddev %.9f, p95 %.9f sec\n", algo->label, trials,
+             st.min, st.median, st.mean, st.stddev, st.p95);
+    }
+    printf("Throughput(%s) = %.3f GB/s, %.4g elements/sec\n", algo->label,
+           gbPerSec, elemsPerSec);
+    if (batch) {
+      printf("Throughput(%s) = %.4g segments/sec\n", algo->label,
+             batch_segments / st.median);
+    }
+#ifdef QSORT_PHASE_TIMES
+    // summed over all workers and trials
+    if (algo->sort == sample_qsort) {
+      ctimer_sum_print(partition_time, "sample_qsort:partition");
+      ctimer_sum_print(base_case_time, "sample_qsort:serial_qsort");
+    }
+#endif
+    break;
+  case FORMAT_CSV:
+    printf("benchmark,algo,dist,placement,n,workers,trials,warmup,"
+           "min_sec,median_sec,mean_sec,stddev_sec,p95_sec,"
+           "elements_per_sec,gb_per_sec,failures");
+#ifdef CTIMER_PERF
+    print_perf_csv_header(&perfSum);
+#endif
+    printf("\n");
+    printf("qsort,%s,%s,%s,%d,%u,%d,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.6g,%.6g,"
+           "%d", algo->name, input_dist_names[dist],
+           placement_names[placement], n, __cilkrts_get_nworkers(),
+           trials, warmups, st.min, st.median, st.mean, st.stddev, st.p95,
+           elemsPerSec, gbPerSec, failCount);
+#ifdef CTIMER_PERF
+    print_perf_csv(&perfSum);
+#endif
+    printf("\n");
+    break;
+  case FORMAT_JSON:
+    printf("{\"benchmark\": \"qsort\", \"algo\": \"%s\", \"dist\": \"%s\", "
+           "\"placement\": \"%s\",\n"
+           " \"n\": %d, \"workers\": %u, \"trials\": %d, \"warmup\": %d,\n",
+           algo->name, input_dist_names[dist], placement_names[placement], n,
+           __cilkrts_get_nworkers(), trials, warmups);
+    printf(" \"min_sec\": %.9f, \"median_sec\": %.9f, \"mean_sec\": %.9f, "
+           "\"stddev_sec\": %.9f, \"p95_sec\": %.9f,\n",
+           st.min, st.median, st.mean, st.stddev, st.p95);
+    printf(" \"elements_per_sec\": %.6g, \"gb_per_sec\": %.6g, "
+           "\"failures\": %d,\n", elemsPerSec, gbPerSec, failCount);
+    if (batch) {
+      printf(" \"segments\": %td, \"segments_per_sec\": %.6g,\n",
+             batch_segments, batch_segments / st.median);
+    }
+#ifdef CTIMER_PERF
+    print_perf_json(&perfSum);
+#endif
+    printf(" \"times_sec\": [");
+    for (int i = 0; i < trials; ++i) {
+      printf("%s%.9f", i > 0 ? ", " : "", times[i]);
+    }
+    printf("]}\n");
+    break;
+  }
 
-  // free integer array
-  free(a);
+  // free integer array, trial times and batch segments
+  free_array(a, n, placement);
+  free(times);
+  free(batch_offsets);
   return failCount;
 }
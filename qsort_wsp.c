@@ -7,15 +7,66 @@
  */
 
 #include <assert.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 #include <cilk/cilkscale.h>
 
 #include "ctimer.h"
 
+// Ranges shorter than the grain size are not worth spawning: sample_qsort
+// finishes them with serial_qsort instead.  A grain size of 1 spawns all the
+// way down to single elements.
+#ifndef QSORT_GRAINSIZE
+#define QSORT_GRAINSIZE 2048
+#endif
+
+// serial_qsort hands ranges shorter than this to insertion_sort.
+#define INSERTION_SORT_CUTOFF 16
+
+// sample_qsort partitions ranges of at least this many elements with
+// parallel_partition, and shorter ones with the serial partition.
+#ifndef PARALLEL_PARTITION_CUTOFF
+#define PARALLEL_PARTITION_CUTOFF (1 << 17)
+#endif
+
+// Number of elements per block in parallel_partition.
+#define PARTITION_BLOCK 4096
+
+// choose_pivot uses a median of three for ranges shorter than this.
+#define NINTHER_CUTOFF 128
+
+// How choose_pivot picks the pivot of a range.
+enum pivot_rule {
+  PIVOT_LAST,     // last element (the original tutorial version)
+  PIVOT_MEDIAN3,  // median of first, middle and last elements
+  PIVOT_NINTHER   // Tukey's ninther: median of three medians of three
+};
+
+// How pivot_partition treats keys equal to the pivot.
+enum partition_mode {
+  PARTITION_TWO_WAY,    // with the keys greater than the pivot
+  PARTITION_THREE_WAY,  // in a block of their own (Dutch national flag)
+  PARTITION_AUTO        // three-way if the pivot sample has duplicates
+};
+
+static const char* const pivot_rule_names[] = {"last", "median3", "ninther"};
+static const char* const partition_mode_names[] = {
+  "two-way", "three-way", "auto"
+};
+
+static ptrdiff_t grainsize = QSORT_GRAINSIZE;
+static enum pivot_rule pivot_rule = PIVOT_NINTHER;
+static enum partition_mode partition_mode = PARTITION_AUTO;
+
 void swap(int* a, int* b) {
   int tmp = *a;
   *a = *b;
@@ -38,29 +89,221 @@ int* partition(int* begin, int* end, int pivot) {
   return end;
 }
 
+// Partition array like partition(), but in parallel.
+// Each block of PARTITION_BLOCK elements counts its elements less than
+// pivot; a prefix sum over the counts gives every block its offsets in
+// a scratch buffer, into which the blocks scatter their elements in
+// parallel before the buffer is copied back.  Falls back to the serial
+// partition if the scratch buffer cannot be allocated.
+int* parallel_partition(int* begin, int* end, int pivot) {
+  ptrdiff_t n = end - begin;
+  ptrdiff_t nblocks = (n + PARTITION_BLOCK - 1) / PARTITION_BLOCK;
+  int* tmp = (int *) malloc(sizeof(int)*n);
+  ptrdiff_t* lows = (ptrdiff_t *) malloc(sizeof(ptrdiff_t)*nblocks);
+  if (!tmp || !lows) {
+    free(tmp);
+    free(lows);
+    return partition(begin, end, pivot);
+  }
 
-// Sort the range between pointers begin and end.
-// end is one past the final element in the range.
-// Use the Quick Sort algorithm, using recursive divide and conquer.
-void sample_qsort(int* begin, int* end) {
-  if (begin < end) {
-    // get last element
-    int last = *(end - 1);
+  // count the elements less than pivot in each block
+  cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+    const int* lo = begin + b * PARTITION_BLOCK;
+    const int* hi = (b == nblocks - 1) ? end : lo + PARTITION_BLOCK;
+    ptrdiff_t count = 0;
+    for (const int* p = lo; p < hi; ++p) {
+      count += (*p < pivot);
+    }
+    lows[b] = count;
+  }
+
+  // exclusive prefix sum: lows[b] = # elements < pivot before block b
+  ptrdiff_t nlow = 0;
+  for (ptrdiff_t b = 0; b < nblocks; ++b) {
+    ptrdiff_t count = lows[b];
+    lows[b] = nlow;
+    nlow += count;
+  }
+
+  // scatter each block to its slots in the lower and upper partitions
+  cilk_for (ptrdiff_t b = 0; b < nblocks; ++b) {
+    ptrdiff_t offset = b * PARTITION_BLOCK;
+    const int* lo = begin + offset;
+    const int* hi = (b == nblocks - 1) ? end : lo + PARTITION_BLOCK;
+    int* low = tmp + lows[b];
+    int* high = tmp + nlow + (offset - lows[b]);
+    for (const int* p = lo; p < hi; ++p) {
+      if (*p < pivot) {
+        *low++ = *p;
+      } else {
+        *high++ = *p;
+      }
+    }
+  }
+
+  cilk_for (ptrdiff_t i = 0; i < n; ++i) {
+    begin[i] = tmp[i];
+  }
+
+  free(tmp);
+  free(lows);
+  return begin + nlow;
+}
+
+// Sort the range between pointers begin and end by straight insertion.
+// Only used for short ranges.
+void insertion_sort(int* begin, int* end) {
+  for (int* i = begin + 1; i < end; ++i) {
+    int val = *i;
+    int* j = i;
+    while (j > begin && *(j - 1) > val) {
+      *j = *(j - 1);
+      --j;
+    }
+    *j = val;
+  }
+}
+
+// Three-way (Dutch national flag) partition of the range between pointers
+// begin and end around pivot.  On return [begin, *lt) holds the elements
+// less than pivot, [*lt, *gt) the elements equal to pivot, and [*gt, end)
+// the elements greater than pivot.
+void partition3(int* begin, int* end, int pivot, int** lt, int** gt) {
+  int* mid = begin;
+  while (mid < end) {
+    if (*mid < pivot) {
+      swap(begin++, mid++);
+    } else if (*mid > pivot) {
+      swap(mid, --end);
+    } else {
+      mid++;
+    }
+  }
+  *lt = begin;
+  *gt = end;
+}
+
+// Return a pointer to the median of *a, *b and *c.
+// Sets *dup if two of the three are equal.
+int* median3(int* a, int* b, int* c, bool* dup) {
+  *dup |= (*a == *b) || (*b == *c) || (*a == *c);
+  if (*a < *b) {
+    if (*b < *c) return b;
+    return (*a < *c) ? c : a;
+  } else {
+    if (*a < *c) return a;
+    return (*b < *c) ? c : b;
+  }
+}
+
+// Choose a pivot for the range between pointers begin and end according
+// to pivot_rule and move it to the last position of the range.
+// Returns true if the sampled candidates contained duplicate keys.
+bool choose_pivot(int* begin, int* end) {
+  ptrdiff_t n = end - begin;
+  int* mid = begin + n / 2;
+  int* p;
+  bool dup = false;
+  switch (pivot_rule) {
+  case PIVOT_LAST:
+    return false;
+  case PIVOT_MEDIAN3:
+    p = median3(begin, mid, end - 1, &dup);
+    break;
+  case PIVOT_NINTHER:
+  default:
+    if (n < NINTHER_CUTOFF) {
+      p = median3(begin, mid, end - 1, &dup);
+    } else {
+      // median of the medians of three evenly spaced triples
+      ptrdiff_t s = n / 8;
+      p = median3(median3(begin, begin + s, begin + 2 * s, &dup),
+                  median3(mid - s, mid, mid + s, &dup),
+                  median3(end - 1 - 2 * s, end - 1 - s, end - 1, &dup),
+                  &dup);
+    }
+    break;
+  }
+  swap(p, end - 1);
+  return dup;
+}
+
+// Partition the (nonempty) range between pointers begin and end around a
+// pivot picked by choose_pivot, in parallel for large ranges.
+// On return [begin, *lo) holds elements less than the pivot and [*hi, end)
+// elements not less than it.  [*lo, *hi) is the pivot itself, or, for a
+// three-way partition, every element equal to the pivot, so that
+// duplicate-heavy ranges shrink quickly.  In PARTITION_AUTO mode, a range
+// is partitioned three ways if the pivot candidates contained duplicates.
+void pivot_partition(int* begin, int* end, int** lo, int** hi) {
+  bool dup = choose_pivot(begin, end);
+  bool three_way = (partition_mode == PARTITION_THREE_WAY)
+    || (partition_mode == PARTITION_AUTO && dup);
+  int last = *(end - 1);
+  bool parallel = (end - begin >= PARALLEL_PARTITION_CUTOFF);
 
+  if (three_way && !parallel) {
+    partition3(begin, end, last, lo, hi);
+  } else if (three_way) {
+    // two parallel passes: split off the elements < last, then split
+    // the rest into the elements == last and > last
+    int* middle = parallel_partition(begin, end, last);
+    *lo = middle;
+    *hi = (last < INT_MAX) ? parallel_partition(middle, end, last + 1) : end;
+  } else {
     // we give partition a pointer to the first element and one past the last element
     // of the range we want to partition
     // move all values which are >= last to the end
     // move all value which are < last to the beginning
     // return a pointer to the first element >= last
-    int * middle = partition(begin, end - 1, last);
+    int * middle = parallel
+      ? parallel_partition(begin, end - 1, last)
+      : partition(begin, end - 1, last);
 
     // move pivot to middle
     swap((end - 1), middle);
+    *lo = middle;
+    *hi = middle + 1;
+  }
+}
+
+// Sort the range between pointers begin and end serially.
+// Same partitioning scheme as sample_qsort, but recurses only into the
+// smaller side and loops on the larger one, so the stack depth stays
+// logarithmic in the size of the range.
+void serial_qsort(int* begin, int* end) {
+  while (end - begin > INSERTION_SORT_CUTOFF) {
+    int *lo, *hi;
+    pivot_partition(begin, end, &lo, &hi);
+    if (lo - begin < end - hi) {
+      serial_qsort(begin, lo);
+      begin = hi;
+    } else {
+      serial_qsort(hi, end);
+      end = lo;
+    }
+  }
+  insertion_sort(begin, end);
+}
+
+// Sort the range between pointers begin and end.
+// end is one past the final element in the range.
+// Use the Quick Sort algorithm, using recursive divide and conquer.
+// Ranges shorter than grainsize are sorted serially.
+void sample_qsort(int* begin, int* end) {
+  if (end - begin < grainsize) {
+    // too small to be worth spawning
+    serial_qsort(begin, end);
+  } else if (begin < end) {
+    // [lo, hi) is in its final place: the pivot, plus its duplicates
+    // in three-way mode
+    int *lo, *hi;
+    pivot_partition(begin, end, &lo, &hi);
 
     // sort in parallel
     cilk_scope {
-      cilk_spawn sample_qsort(middle+1, end); // sort upper partition w/o pivot
-      sample_qsort(begin, middle); // sort lower partition
+      cilk_spawn sample_qsort(hi, end); // sort upper partition w/o pivot
+      sample_qsort(begin, lo); // sort lower partition
     }
   }
 }
@@ -75,27 +318,147 @@ void print_array(const int *a, size_t n) {
   printf(")\n");
 }
 
+// Largest prefix of the input that autotune_grainsize sorts per candidate.
+#define AUTOTUNE_SAMPLE (1 << 20)
+
+// autotune_grainsize asks for this much burdened parallelism per worker.
+#define AUTOTUNE_SLACKNESS 10
+
+// Burdened parallelism (work / burdened span) of a cilkscale measurement.
+double burdened_parallelism(wsp_t w) {
+  return w.bspan > 0 ? (double)w.work / (double)w.bspan : 0.0;
+}
+
+// Pick a grain size for sample_qsort from cilkscale measurements on a copy of
+// (a prefix of) the input.  Coarsening cuts spawn overhead out of the work but
+// lengthens the span, so keep the largest power-of-two grain size that still
+// leaves AUTOTUNE_SLACKNESS times as much burdened parallelism as there are
+// workers.  Falls back to QSORT_GRAINSIZE when cilkscale is not enabled.
+ptrdiff_t autotune_grainsize(const int* a, int n) {
+  int m = n < AUTOTUNE_SAMPLE ? n : AUTOTUNE_SAMPLE;
+  int* sample = (int *) malloc(sizeof(int)*m);
+  if (!sample) {
+    return QSORT_GRAINSIZE;
+  }
+
+  double target = (double)AUTOTUNE_SLACKNESS * __cilkrts_get_nworkers();
+  ptrdiff_t best = 0, mostParallel = QSORT_GRAINSIZE;
+  double maxPar = 0.0;
+  for (ptrdiff_t g = 8; g <= m && g <= (1 << 16); g *= 2) {
+    memcpy(sample, a, sizeof(int)*m);
+    grainsize = g;
+
+    wsp_t start = wsp_getworkspan();
+    sample_qsort(sample, sample + m);
+    wsp_t end = wsp_getworkspan();
+
+    double par = burdened_parallelism(wsp_sub(end, start));
+    if (par >= target) {
+      best = g;
+    }
+    if (par > maxPar) {
+      maxPar = par;
+      mostParallel = g;
+    }
+  }
+
+  free(sample);
+  // if no candidate meets the target, settle for the most parallel one
+  return best > 0 ? best : mostParallel;
+}
+
+// Return the index of name in names[0..count), or -1 if it is not there.
+int lookup_name(const char* name, const char* const* names, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [<options>] [<n> [<trials>]]\n", prog);
+  fprintf(stderr, "  -g, --grain <g>  sort ranges shorter than <g> serially;\n"
+                  "                   0 auto-tunes (default %d)\n",
+          QSORT_GRAINSIZE);
+  fprintf(stderr, "  -p, --pivot <r>  pivot rule: last, median3, ninther "
+                  "(default ninther)\n");
+  fprintf(stderr, "  -m, --partition <m>\n"
+                  "                   keys equal to the pivot: two-way, "
+                  "three-way, auto\n"
+                  "                   (default auto)\n");
+}
+
 // A simple test harness.  Program takes 2 optional arguments:
 //   First argument specifies the length of the array to sort.
-//   Defaults to 10 thousand.
+//   Defaults to 1 million.
 //   Second argument specifies the number of trials to run.
 //   Defaults to 1.
+// Option -g/--grain sets the grain size of sample_qsort; -g 0 auto-tunes it.
+// Options -p/--pivot and -m/--partition select the pivot rule and the
+// partition mode.
+// Unless the grain size is 1, the work and span of the uncoarsened sort
+// (grain size 1) are measured on the same input and reported alongside.
 int main(int argc, char **argv) {
   int *a = NULL, failCount = 0;
   int failFlag;
 
+  static const struct option longopts[] = {
+    {"grain",     required_argument, NULL, 'g'},
+    {"pivot",     required_argument, NULL, 'p'},
+    {"partition", required_argument, NULL, 'm'},
+    {"help",      no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  int opt, idx;
+  while ((opt = getopt_long(argc, argv, "g:p:m:h", longopts, NULL)) != -1) {
+    switch (opt) {
+    case 'g':
+      grainsize = atol(optarg);
+      break;
+    case 'p':
+      idx = lookup_name(optarg, pivot_rule_names, 3);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      pivot_rule = (enum pivot_rule) idx;
+      break;
+    case 'm':
+      idx = lookup_name(optarg, partition_mode_names, 3);
+      if (idx < 0) {
+        usage(argv[0]);
+        exit(-1);
+      }
+      partition_mode = (enum partition_mode) idx;
+      break;
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+    default:
+      usage(argv[0]);
+      exit(-1);
+    }
+  }
+
   // get number of integers to sort, default 1 million
   int n = 1000*1000;
-  if (argc > 1) {
-    n = atoi(argv[1]);
+  if (optind < argc) {
+    n = atoi(argv[optind]);
   }
-  printf("Sorting %d integers\n", n);
+  printf("Sorting %d integers (%s pivot, %s partition)\n", n,
+         pivot_rule_names[pivot_rule], partition_mode_names[partition_mode]);
 
   // check arguments
   if (n < 1) {
     printf("array length must be positive\n");
     exit(-1);
   }
+  if (grainsize < 0) {
+    printf("grain size must be non-negative\n");
+    exit(-1);
+  }
 
   // allocate memory for array
   a = (int *) malloc(sizeof(int)*n);
@@ -110,6 +473,30 @@ int main(int argc, char **argv) {
     a[i] = rand_r(&seed);
   }
 
+  if (grainsize == 0) {
+    grainsize = autotune_grainsize(a, n);
+    printf("Auto-tuned grain size = %ld\n", (long)grainsize);
+  }
+
+  // measure the uncoarsened sort on a copy of the same input
+  wsp_t base = {0};
+  ptrdiff_t coarse = grainsize;
+  if (coarse != 1) {
+    int *b = (int *) malloc(sizeof(int)*n);
+    if (!b) {
+      printf("array allocation failed\n");
+      exit(-1);
+    }
+    memcpy(b, a, sizeof(int)*n);
+    grainsize = 1;
+    wsp_t bstart = wsp_getworkspan();
+    sample_qsort(b, b + n);
+    wsp_t bend = wsp_getworkspan();
+    base = wsp_sub(bend, bstart);
+    grainsize = coarse;
+    free(b);
+  }
+
   ctimer_t t;
   ctimer_start(&t);
 
@@ -144,7 +531,19 @@ int main(int argc, char **argv) {
   }
 
   ctimer_print(t, "sample_qsort");
-  wsp_dump(wsp_sub(end, start), "sample_qsort");
+  wsp_t coarsened = wsp_sub(end, start);
+  wsp_dump(coarsened, "sample_qsort");
+  if (coarse != 1) {
+    wsp_dump(base, "sample_qsort(grain=1)");
+    if (base.work > 0 && base.span > 0) {
+      printf("Grain size %ld vs. 1: work x%.3f, span x%.3f, "
+             "burdened parallelism %.2f vs. %.2f\n",
+             (long)coarse,
+             (double)coarsened.work / (double)base.work,
+             (double)coarsened.span / (double)base.span,
+             burdened_parallelism(coarsened), burdened_parallelism(base));
+    }
+  }
 
   // free integer array
   free(a);
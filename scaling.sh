@@ -0,0 +1,135 @@
+#!/bin/sh
+#
+# Scalability sweep: run the tutorial programs over a matrix of worker counts
+# and problem sizes and collect the results into one CSV on stdout.
+#
+#   ./scaling.sh [-b <bindir>] [-w "<workers>"] [-p] [<program> ...]
+#
+#   -b <bindir>     directory with the fib, nqueens, qsort and qsort_wsp
+#                   binaries (default: .)
+#   -w "<counts>"   worker counts to run (default: 1 2 4 ... up to and
+#                   including the number of online cores)
+#   -p              pin the workers of each run to cores 0..P-1 with taskset
+#   <program>       programs to sweep (default: fib nqueens qsort qsort_wsp)
+#
+# Problem sizes come from FIB_SIZES, NQUEENS_SIZES, QSORT_SIZES and
+# QSORT_WSP_SIZES (space-separated).  Programs missing from <bindir> are
+# skipped with a note on stderr.
+#
+# Each row reports the best kernel time of the run, its speedup over the run
+# with the first worker count, and efficiency = speedup * first / workers.
+# With binaries built with -fcilktool=cilkscale, the parallelism and burdened
+# parallelism columns are filled in from the wsp_dump() output.
+
+bindir=.
+workers=
+pin=0
+
+while getopts "b:w:ph" opt; do
+  case $opt in
+    b) bindir=$OPTARG ;;
+    w) workers=$OPTARG ;;
+    p) pin=1 ;;
+    h) sed -n '2,22s/^# \{0,1\}//p' "$0"; exit 0 ;;
+    *) exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+programs=${*:-fib nqueens qsort qsort_wsp}
+
+: "${FIB_SIZES:=30 35}"
+: "${NQUEENS_SIZES:=12 13}"
+: "${QSORT_SIZES:=1000000 10000000}"
+: "${QSORT_WSP_SIZES:=1000000 10000000}"
+
+if [ -z "$workers" ]; then
+  ncores=$(getconf _NPROCESSORS_ONLN)
+  p=1
+  while [ "$p" -lt "$ncores" ]; do
+    workers="$workers $p"
+    p=$((p * 2))
+  done
+  workers="$workers $ncores"
+fi
+
+if [ "$pin" -eq 1 ] && ! command -v taskset > /dev/null; then
+  echo "taskset not found; running unpinned" >&2
+  pin=0
+fi
+
+# Kernel label of each program's Time(...) and wsp_dump() lines, and its
+# arguments for problem size n.
+label() {
+  case $1 in
+    fib) echo fib ;;
+    nqueens) echo nqueens ;;
+    qsort | qsort_wsp) echo sample_qsort ;;
+  esac
+}
+
+sizes() {
+  case $1 in
+    fib) echo "$FIB_SIZES" ;;
+    nqueens) echo "$NQUEENS_SIZES" ;;
+    qsort) echo "$QSORT_SIZES" ;;
+    qsort_wsp) echo "$QSORT_WSP_SIZES" ;;
+  esac
+}
+
+# Print "<time> <parallelism> <burdened parallelism>" for one run's output:
+# the fastest Time(<label>) and the last matching wsp_dump() row.
+parse() {
+  awk -v label="$1" '
+    index($0, "Time(" label ") = ") == 1 {
+      t = $3 + 0
+      if (best == "" || t < best) best = t
+    }
+    {
+      n = split($0, f, ",")
+      if (n == 6 && f[1] == label) { par = f[4]; bpar = f[6] }
+    }
+    END { if (best != "") print best, par + 0, bpar + 0 }'
+}
+
+echo "program,n,workers,time_sec,speedup,efficiency,parallelism,burdened_parallelism"
+
+for prog in $programs; do
+  bin=$bindir/$prog
+  if [ ! -x "$bin" ]; then
+    echo "$bin not found; skipping $prog" >&2
+    continue
+  fi
+  lab=$(label "$prog")
+  for n in $(sizes "$prog"); do
+    base=
+    base_workers=
+    for p in $workers; do
+      if [ "$pin" -eq 1 ]; then
+        cmd="taskset -c 0-$((p - 1)) $bin $n"
+      else
+        cmd="$bin $n"
+      fi
+      # cilkscale writes wsp_dump() rows to stderr unless CILKSCALE_OUT
+      # points elsewhere
+      if ! result=$(CILK_NWORKERS=$p $cmd 2>&1 | parse "$lab") \
+          || [ -z "$result" ]; then
+        echo "$prog $n failed on $p workers" >&2
+        continue
+      fi
+      set -- $result
+      if [ -z "$base" ]; then
+        base=$1
+        base_workers=$p
+      fi
+      awk -v prog="$prog" -v n="$n" -v p="$p" -v t="$1" -v par="$2" \
+          -v bpar="$3" -v base="$base" -v bw="$base_workers" 'BEGIN {
+        s = t > 0 ? base / t : 0
+        if (par == 0) par = ""
+        if (bpar == 0) bpar = ""
+        printf "%s,%s,%s,%.9f,%.3f,%.3f,%s,%s\n", prog, n, p, t, s,
+               s * bw / p, par, bpar
+      }'
+    done
+  done
+done
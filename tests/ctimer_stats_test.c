@@ -0,0 +1,47 @@
+/*
+ * ctimer_stats_test.c
+ *
+ * Checks of the ctimer_stats_t histogram at the top of its range: laps of
+ * 2^CTIMER_STATS_MAX_LOG2 nsec and longer must land in the last bucket.
+ * Build with -fsanitize=address to catch writes past the buckets.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ctimer.h"
+
+static int failures = 0;
+
+static void check(int ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+int main(void) {
+  uint64_t lo = (uint64_t) 1 << CTIMER_STATS_MAX_LOG2;
+  uint64_t hi = ((uint64_t) 1 << (CTIMER_STATS_MAX_LOG2 + 1)) - 1;
+
+  check(_ctimer_stats_bucket(lo) == CTIMER_STATS_BUCKETS - 1,
+        "2^MAX_LOG2 nsec is in the last bucket");
+  check(_ctimer_stats_bucket(hi) == CTIMER_STATS_BUCKETS - 1,
+        "2^(MAX_LOG2+1)-1 nsec is in the last bucket");
+
+  ctimer_stats_t s;
+  ctimer_stats_reset(&s);
+  ctimer_stats_record_nsec(&s, lo);
+  ctimer_stats_record_nsec(&s, hi);
+  check(s.count == 2, "count");
+  check(s.min == lo && s.max == hi, "exact min and max");
+  check(s.buckets[CTIMER_STATS_BUCKETS - 1] == 2, "last bucket count");
+
+  uint64_t p50 = ctimer_stats_percentile(&s, 50.0);
+  check(p50 >= lo && p50 <= hi, "p50 within the recorded range");
+  check(ctimer_stats_percentile(&s, 100.0) == hi, "p100 is the maximum");
+
+  printf("%s\n", failures ? "ctimer_stats_test failed"
+                          : "ctimer_stats_test passed");
+  return failures != 0;
+}